@@ -1,11 +1,47 @@
 {
     "targets": [
+        {
+            "target_name": "ethash",
+            "type": "static_library",
+            "sources": [
+                "src/dag_validator.cc",
+                "src/ethash.cc",
+                "src/keccak_x4.cc",
+                "src/seal_hash.cc",
+                "src/share_grading.cc",
+                "src/thread_pool.cc",
+                "src/verify_pipeline.cc",
+                "src/verify_service.cc"
+            ],
+            "cflags": [ "-fPIC" ],
+            "direct_dependent_settings": {
+                "include_dirs": [ "src" ]
+            },
+            "link_settings": {
+                "libraries": [ "-lrt", "-pthread" ]
+            }
+        },
         {
             "target_name": "ethlib",
             "sources": [ "libeth.cc" ],
+            "dependencies": [ "ethash" ],
             "include_dirs" : [
  	 			"<!(node -e \"require('nan')\")"
 			]
+        },
+        {
+            "target_name": "libeth-gen",
+            "type": "executable",
+            "sources": [ "tools/libeth-gen.cc" ],
+            "dependencies": [ "ethash" ],
+            "ldflags": [ "-pthread" ]
+        },
+        {
+            "target_name": "libeth-verifyd",
+            "type": "executable",
+            "sources": [ "tools/libeth-verifyd.cc" ],
+            "dependencies": [ "ethash" ],
+            "ldflags": [ "-pthread" ]
         }
     ],
-}
\ No newline at end of file
+}
@@ -19,803 +19,895 @@
  **/
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <sstream>
+#include <cerrno>
+#include <cmath>
 #include <cstring>
 #include <type_traits>
 
 #include <nan.h>
 
-constexpr static int light_cache_init_size = 1 << 24;
-constexpr static int light_cache_growth = 1 << 17;
-constexpr static int light_cache_rounds = 3;
-constexpr static int full_dataset_init_size = 1 << 30;
-constexpr static int full_dataset_growth = 1 << 23;
-constexpr static int full_dataset_item_parents = 256;
-constexpr static int ecip_1099_activation_epoch = 390; // classic mainnet
-constexpr size_t l1_cache_size = 16 * 1024;
-static const uint32_t fnv_prime = 0x01000193;
+#include "dag_validator.h"
+#include "ethash.h"
+#include "seal_hash.h"
+#include "share_grading.h"
+#include "thread_pool.h"
+#include "verify_pipeline.h"
+#include "verify_service.h"
 
-#define ETHASH_LIGHT_CACHE_ITEM_SIZE 64
-#define ETHASH_FULL_DATASET_ITEM_SIZE 128
-
-#define to_le64(X) X
-
-/** Loads 64-bit integer from given memory location as little-endian number. */
-static uint64_t load_le(const uint8_t* data)
+template <class T>
+std::string toHex(T const& _data, int _w = 2)
 {
-    /* memcpy is the best way of expressing the intention. Every compiler will
-       optimize is to single load instruction if the target architecture
-       supports unaligned memory access (GCC and clang even in O0).
-       This is great trick because we are violating C/C++ memory alignment
-       restrictions with no performance penalty. */
-    uint64_t word;
-    //__builtin_memcpy(&word, data, sizeof(word));
-    memcpy(&word, data, sizeof(word));
-    return to_le64(word);
+    std::ostringstream ret;
+    unsigned ii = 0;
+    for (auto i : _data)
+        ret << std::hex << std::setfill('0') << std::setw(ii++ ? 2 : _w)
+            << (int)(typename std::make_unsigned<decltype(i)>::type)i;
+    return ret.str();
 }
 
-static uint64_t rol(uint64_t x, unsigned s)
-{
-    return (x << s) | (x >> (64 - s));
+NAN_METHOD(echo) {
+    std::ostringstream oss;
+    oss << "a + " << "b";
+    info.GetReturnValue().Set(Nan::New(oss.str()).ToLocalChecked());
 }
 
-static inline uint32_t fnv1(uint32_t u, uint32_t v) noexcept
-{
-    return (u * fnv_prime) ^ v;
+// Context last returned to this thread by getEpochContextBin(), kept for
+// getLightCache() calls without an epoch argument. Each isolate runs on its
+// own thread so workers do not see each other's selection.
+static thread_local epoch_context_ptr current_ctx;
+
+static epoch_context_ptr getSharedContext(int epoch_number) {
+    epoch_context_ptr ctx = shared_epoch_contexts().get(epoch_number);
+    if (!ctx)
+        Nan::ThrowError("cannot create epoch context (invalid epoch or out of memory)");
+    return ctx;
 }
 
-static const uint64_t round_constants[24] = {
-    0x0000000000000001,
-    0x0000000000008082,
-    0x800000000000808a,
-    0x8000000080008000,
-    0x000000000000808b,
-    0x0000000080000001,
-    0x8000000080008081,
-    0x8000000000008009,
-    0x000000000000008a,
-    0x0000000000000088,
-    0x0000000080008009,
-    0x000000008000000a,
-    0x000000008000808b,
-    0x800000000000008b,
-    0x8000000000008089,
-    0x8000000000008003,
-    0x8000000000008002,
-    0x8000000000000080,
-    0x000000000000800a,
-    0x800000008000000a,
-    0x8000000080008081,
-    0x8000000000008080,
-    0x0000000080000001,
-    0x8000000080008008,
-};
+// Epochs arrive as JS numbers: only integers in [0, max_epoch_number] are
+// converted, a NaN or out of range double is undefined behaviour as an int.
+static bool getEpochNumber(v8::Local<v8::Value> value, int& out) {
+    if (!value->IsNumber())
+        return false;
+    const double d = Nan::To<double>(value).FromJust();
+    if (!(d >= 0 && d <= max_epoch_number) || d != std::floor(d))
+        return false;
+    out = Nan::To<int32_t>(value).FromJust();
+    return true;
+}
 
-void ethash_keccakf1600(uint64_t state[25])
-{
-    /* The implementation based on the "simple" implementation by Ronny Van Keer. */
-
-    int round;
-
-    uint64_t Aba, Abe, Abi, Abo, Abu;
-    uint64_t Aga, Age, Agi, Ago, Agu;
-    uint64_t Aka, Ake, Aki, Ako, Aku;
-    uint64_t Ama, Ame, Ami, Amo, Amu;
-    uint64_t Asa, Ase, Asi, Aso, Asu;
-
-    uint64_t Eba, Ebe, Ebi, Ebo, Ebu;
-    uint64_t Ega, Ege, Egi, Ego, Egu;
-    uint64_t Eka, Eke, Eki, Eko, Eku;
-    uint64_t Ema, Eme, Emi, Emo, Emu;
-    uint64_t Esa, Ese, Esi, Eso, Esu;
-
-    uint64_t Ba, Be, Bi, Bo, Bu;
-
-    uint64_t Da, De, Di, Do, Du;
-
-    Aba = state[0];
-    Abe = state[1];
-    Abi = state[2];
-    Abo = state[3];
-    Abu = state[4];
-    Aga = state[5];
-    Age = state[6];
-    Agi = state[7];
-    Ago = state[8];
-    Agu = state[9];
-    Aka = state[10];
-    Ake = state[11];
-    Aki = state[12];
-    Ako = state[13];
-    Aku = state[14];
-    Ama = state[15];
-    Ame = state[16];
-    Ami = state[17];
-    Amo = state[18];
-    Amu = state[19];
-    Asa = state[20];
-    Ase = state[21];
-    Asi = state[22];
-    Aso = state[23];
-    Asu = state[24];
-
-    for (round = 0; round < 24; round += 2)
-    {
-        /* Round (round + 0): Axx -> Exx */
-
-        Ba = Aba ^ Aga ^ Aka ^ Ama ^ Asa;
-        Be = Abe ^ Age ^ Ake ^ Ame ^ Ase;
-        Bi = Abi ^ Agi ^ Aki ^ Ami ^ Asi;
-        Bo = Abo ^ Ago ^ Ako ^ Amo ^ Aso;
-        Bu = Abu ^ Agu ^ Aku ^ Amu ^ Asu;
-
-        Da = Bu ^ rol(Be, 1);
-        De = Ba ^ rol(Bi, 1);
-        Di = Be ^ rol(Bo, 1);
-        Do = Bi ^ rol(Bu, 1);
-        Du = Bo ^ rol(Ba, 1);
-
-        Ba = Aba ^ Da;
-        Be = rol(Age ^ De, 44);
-        Bi = rol(Aki ^ Di, 43);
-        Bo = rol(Amo ^ Do, 21);
-        Bu = rol(Asu ^ Du, 14);
-        Eba = Ba ^ (~Be & Bi) ^ round_constants[round];
-        Ebe = Be ^ (~Bi & Bo);
-        Ebi = Bi ^ (~Bo & Bu);
-        Ebo = Bo ^ (~Bu & Ba);
-        Ebu = Bu ^ (~Ba & Be);
-
-        Ba = rol(Abo ^ Do, 28);
-        Be = rol(Agu ^ Du, 20);
-        Bi = rol(Aka ^ Da, 3);
-        Bo = rol(Ame ^ De, 45);
-        Bu = rol(Asi ^ Di, 61);
-        Ega = Ba ^ (~Be & Bi);
-        Ege = Be ^ (~Bi & Bo);
-        Egi = Bi ^ (~Bo & Bu);
-        Ego = Bo ^ (~Bu & Ba);
-        Egu = Bu ^ (~Ba & Be);
-
-        Ba = rol(Abe ^ De, 1);
-        Be = rol(Agi ^ Di, 6);
-        Bi = rol(Ako ^ Do, 25);
-        Bo = rol(Amu ^ Du, 8);
-        Bu = rol(Asa ^ Da, 18);
-        Eka = Ba ^ (~Be & Bi);
-        Eke = Be ^ (~Bi & Bo);
-        Eki = Bi ^ (~Bo & Bu);
-        Eko = Bo ^ (~Bu & Ba);
-        Eku = Bu ^ (~Ba & Be);
-
-        Ba = rol(Abu ^ Du, 27);
-        Be = rol(Aga ^ Da, 36);
-        Bi = rol(Ake ^ De, 10);
-        Bo = rol(Ami ^ Di, 15);
-        Bu = rol(Aso ^ Do, 56);
-        Ema = Ba ^ (~Be & Bi);
-        Eme = Be ^ (~Bi & Bo);
-        Emi = Bi ^ (~Bo & Bu);
-        Emo = Bo ^ (~Bu & Ba);
-        Emu = Bu ^ (~Ba & Be);
-
-        Ba = rol(Abi ^ Di, 62);
-        Be = rol(Ago ^ Do, 55);
-        Bi = rol(Aku ^ Du, 39);
-        Bo = rol(Ama ^ Da, 41);
-        Bu = rol(Ase ^ De, 2);
-        Esa = Ba ^ (~Be & Bi);
-        Ese = Be ^ (~Bi & Bo);
-        Esi = Bi ^ (~Bo & Bu);
-        Eso = Bo ^ (~Bu & Ba);
-        Esu = Bu ^ (~Ba & Be);
-
-
-        /* Round (round + 1): Exx -> Axx */
-
-        Ba = Eba ^ Ega ^ Eka ^ Ema ^ Esa;
-        Be = Ebe ^ Ege ^ Eke ^ Eme ^ Ese;
-        Bi = Ebi ^ Egi ^ Eki ^ Emi ^ Esi;
-        Bo = Ebo ^ Ego ^ Eko ^ Emo ^ Eso;
-        Bu = Ebu ^ Egu ^ Eku ^ Emu ^ Esu;
-
-        Da = Bu ^ rol(Be, 1);
-        De = Ba ^ rol(Bi, 1);
-        Di = Be ^ rol(Bo, 1);
-        Do = Bi ^ rol(Bu, 1);
-        Du = Bo ^ rol(Ba, 1);
-
-        Ba = Eba ^ Da;
-        Be = rol(Ege ^ De, 44);
-        Bi = rol(Eki ^ Di, 43);
-        Bo = rol(Emo ^ Do, 21);
-        Bu = rol(Esu ^ Du, 14);
-        Aba = Ba ^ (~Be & Bi) ^ round_constants[round + 1];
-        Abe = Be ^ (~Bi & Bo);
-        Abi = Bi ^ (~Bo & Bu);
-        Abo = Bo ^ (~Bu & Ba);
-        Abu = Bu ^ (~Ba & Be);
-
-        Ba = rol(Ebo ^ Do, 28);
-        Be = rol(Egu ^ Du, 20);
-        Bi = rol(Eka ^ Da, 3);
-        Bo = rol(Eme ^ De, 45);
-        Bu = rol(Esi ^ Di, 61);
-        Aga = Ba ^ (~Be & Bi);
-        Age = Be ^ (~Bi & Bo);
-        Agi = Bi ^ (~Bo & Bu);
-        Ago = Bo ^ (~Bu & Ba);
-        Agu = Bu ^ (~Ba & Be);
-
-        Ba = rol(Ebe ^ De, 1);
-        Be = rol(Egi ^ Di, 6);
-        Bi = rol(Eko ^ Do, 25);
-        Bo = rol(Emu ^ Du, 8);
-        Bu = rol(Esa ^ Da, 18);
-        Aka = Ba ^ (~Be & Bi);
-        Ake = Be ^ (~Bi & Bo);
-        Aki = Bi ^ (~Bo & Bu);
-        Ako = Bo ^ (~Bu & Ba);
-        Aku = Bu ^ (~Ba & Be);
-
-        Ba = rol(Ebu ^ Du, 27);
-        Be = rol(Ega ^ Da, 36);
-        Bi = rol(Eke ^ De, 10);
-        Bo = rol(Emi ^ Di, 15);
-        Bu = rol(Eso ^ Do, 56);
-        Ama = Ba ^ (~Be & Bi);
-        Ame = Be ^ (~Bi & Bo);
-        Ami = Bi ^ (~Bo & Bu);
-        Amo = Bo ^ (~Bu & Ba);
-        Amu = Bu ^ (~Ba & Be);
-
-        Ba = rol(Ebi ^ Di, 62);
-        Be = rol(Ego ^ Do, 55);
-        Bi = rol(Eku ^ Du, 39);
-        Bo = rol(Ema ^ Da, 41);
-        Bu = rol(Ese ^ De, 2);
-        Asa = Ba ^ (~Be & Bi);
-        Ase = Be ^ (~Bi & Bo);
-        Asi = Bi ^ (~Bo & Bu);
-        Aso = Bo ^ (~Bu & Ba);
-        Asu = Bu ^ (~Ba & Be);
-    }
-
-    state[0] = Aba;
-    state[1] = Abe;
-    state[2] = Abi;
-    state[3] = Abo;
-    state[4] = Abu;
-    state[5] = Aga;
-    state[6] = Age;
-    state[7] = Agi;
-    state[8] = Ago;
-    state[9] = Agu;
-    state[10] = Aka;
-    state[11] = Ake;
-    state[12] = Aki;
-    state[13] = Ako;
-    state[14] = Aku;
-    state[15] = Ama;
-    state[16] = Ame;
-    state[17] = Ami;
-    state[18] = Amo;
-    state[19] = Amu;
-    state[20] = Asa;
-    state[21] = Ase;
-    state[22] = Asi;
-    state[23] = Aso;
-    state[24] = Asu;
+static const char* const epoch_range_error =
+    "epoch must be an integer from 0 to the last supported epoch";
+
+static bool getHash256(v8::Local<v8::Value> value, hash256& out) {
+    if (!node::Buffer::HasInstance(value) || node::Buffer::Length(value) != sizeof(out))
+        return false;
+    memcpy(out.bytes, node::Buffer::Data(value), sizeof(out));
+    return true;
 }
 
+// Nonce is passed as the 8 header bytes, i.e. big-endian.
+static bool getNonce(v8::Local<v8::Value> value, uint64_t& out) {
+    if (!node::Buffer::HasInstance(value) || node::Buffer::Length(value) != sizeof(out))
+        return false;
+    memcpy(&out, node::Buffer::Data(value), sizeof(out));
+    out = be::uint64(out);
+    return true;
+}
 
-union hash256
-{
-    uint64_t word64s[4];
-    uint32_t word32s[8];
-    uint8_t bytes[32];
-    char str[32];
-};
+// Completes the PoolWorkers of one environment on its loop. Pool threads
+// hand finished workers over through a uv_async_t, so no libuv threadpool
+// thread waits for the pool; the handle keeps the loop alive only while
+// workers are out. When the environment goes away (a worker thread is
+// terminated) the cleanup hook raises closing(), waits for the workers
+// still on the pool and frees them without calling back.
+class PoolCompletions {
+public:
+    // Created on first use by each environment, i.e. each isolate thread.
+    static PoolCompletions* Current() {
+        if (!current_)
+            current_ = new PoolCompletions();
+        return current_;
+    }
 
-union hash512
-{
-    uint64_t word64s[8];
-    uint32_t word32s[16];
-    uint8_t bytes[64];
-    char str[64];
-};
+    // On the loop thread, before the worker goes to the pool.
+    void Started() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_++ == 0)
+            uv_ref(reinterpret_cast<uv_handle_t*>(&async_));
+    }
 
-union hash1024
-{
-    union hash512 hash512s[2];
-    uint64_t word64s[16];
-    uint32_t word32s[32];
-    uint8_t bytes[128];
-    char str[128];
-};
+    // On a pool thread, once per started worker.
+    void Finished(Nan::AsyncWorker* worker) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --running_;
+        finished_.push_back(worker);
+        if (closing_)
+            cv_.notify_all();
+        else
+            uv_async_send(&async_);  // Under the lock: the handle is closed right after the last one.
+    }
 
-union hash2048
-{
-    union hash512 hash512s[4];
-    uint64_t word64s[32];
-    uint32_t word32s[64];
-    uint8_t bytes[256];
-    char str[256];
-};
+    const std::atomic<bool>& closing() const {
+        return closing_;
+    }
 
-inline hash512 fnv1(const hash512& u, const hash512& v) noexcept
-{
-    hash512 r;
-    for (size_t i = 0; i < sizeof(r) / sizeof(r.word32s[0]); ++i)
-        r.word32s[i] = fnv1(u.word32s[i], v.word32s[i]);
-    return r;
-}
+private:
+    PoolCompletions() : isolate_(v8::Isolate::GetCurrent()) {
+        uv_async_init(Nan::GetCurrentEventLoop(), &async_, OnAsync);
+        async_.data = this;
+        uv_unref(reinterpret_cast<uv_handle_t*>(&async_));
+        node::AddEnvironmentCleanupHook(isolate_, OnCleanup, this);
+    }
 
-struct epoch_context
-{
-    const int epoch_number;
-    const int light_cache_num_items;
-    const union hash512* const light_cache;
-    const uint32_t* const l1_cache;
-    const int full_dataset_num_items;
-};
+    static void OnAsync(uv_async_t* async) {
+        PoolCompletions* self = static_cast<PoolCompletions*>(async->data);
+        std::vector<Nan::AsyncWorker*> finished;
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            finished.swap(self->finished_);
+            if (self->running_ == 0)
+                uv_unref(reinterpret_cast<uv_handle_t*>(&self->async_));
+        }
+        for (Nan::AsyncWorker* worker : finished) {
+            worker->WorkComplete();
+            worker->Destroy();
+        }
+    }
 
-struct epoch_context_full : epoch_context
-{
-    hash1024* full_dataset;
-
-    constexpr epoch_context_full(int epoch, int light_num_items,
-        const hash512* light, const uint32_t* l1, int dataset_num_items,
-        hash1024* dataset) noexcept
-      : epoch_context{epoch, light_num_items, light, l1, dataset_num_items},
-        full_dataset{dataset}
-    {}
-};
+    static void OnCleanup(void* arg) {
+        PoolCompletions* self = static_cast<PoolCompletions*>(arg);
+        current_ = nullptr;
+        std::vector<Nan::AsyncWorker*> finished;
+        {
+            std::unique_lock<std::mutex> lock(self->mutex_);
+            self->closing_ = true;
+            self->cv_.wait(lock, [self] { return self->running_ == 0; });
+            finished.swap(self->finished_);
+        }
+        for (Nan::AsyncWorker* worker : finished)
+            worker->Destroy();
+        uv_close(reinterpret_cast<uv_handle_t*>(&self->async_), [](uv_handle_t* h) {
+            delete static_cast<PoolCompletions*>(h->data);
+        });
+    }
 
-void keccak(
-    uint64_t* out, size_t bits, const uint8_t* data, size_t size)
-{
-    static const size_t word_size = sizeof(uint64_t);
-    const size_t hash_size = bits / 8;
-    const size_t block_size = (1600 - bits * 2) / 8;
+    static thread_local PoolCompletions* current_;
 
-    size_t i;
-    uint64_t* state_iter;
-    uint64_t last_word = 0;
-    uint8_t* last_word_iter = (uint8_t*)&last_word;
+    v8::Isolate* isolate_;
+    uv_async_t async_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<Nan::AsyncWorker*> finished_;
+    unsigned running_ = 0;
+    std::atomic<bool> closing_{false};
+};
 
-    uint64_t state[25] = {0};
+thread_local PoolCompletions* PoolCompletions::current_ = nullptr;
 
-    while (size >= block_size)
-    {
-        for (i = 0; i < (block_size / word_size); ++i)
-        {
-            state[i] ^= load_le(data);
-            data += word_size;
-        }
+// An AsyncWorker whose Execute() runs on the shared native pool at its
+// priority instead of the libuv threadpool, and whose callback runs on the
+// loop of the environment that queued it.
+class PoolWorker : public Nan::AsyncWorker {
+public:
+    PoolWorker(Nan::Callback* callback, const char* resource_name, task_priority priority)
+      : Nan::AsyncWorker(callback, resource_name), priority_(priority) {}
 
-        ethash_keccakf1600(state);
+    static void Queue(PoolWorker* worker) {
+        worker->completions_ = PoolCompletions::Current();
+        worker->completions_->Started();
+        shared_thread_pool().submit([worker] { worker->Run(); }, worker->priority_);
+    }
 
-        size -= block_size;
+protected:
+    // Execute(), then Complete(). Workers going on in further pool tasks
+    // override it and call Complete() once they are done.
+    virtual void Run() {
+        Execute();
+        Complete();
     }
 
-    state_iter = state;
+    // The worker must not be touched afterwards, the loop may free it.
+    void Complete() {
+        completions_->Finished(this);
+    }
 
-    while (size >= word_size)
-    {
-        *state_iter ^= load_le(data);
-        ++state_iter;
-        data += word_size;
-        size -= word_size;
+    // Set once the environment is going away, nobody waits for the result.
+    const std::atomic<bool>& Cancelled() const {
+        return completions_->closing();
     }
 
-    while (size > 0)
-    {
-        *last_word_iter = *data;
-        ++last_word_iter;
-        ++data;
-        --size;
+private:
+    task_priority priority_;
+    PoolCompletions* completions_ = nullptr;
+};
+
+NAN_METHOD(getEpochContext) {
+    std::ostringstream oss;
+    int epoch_number = 0;
+    if (info[0]->IsNumber() && !getEpochNumber(info[0], epoch_number))
+        return Nan::ThrowRangeError(epoch_range_error);
+
+    // call get epoch context
+    epoch_context_ptr ctx = getSharedContext(epoch_number);
+    if (!ctx)
+        return;
+
+    oss << "{";
+    oss << "\"epochNumber\":" << ctx->epoch_number << ",";
+    oss << "\"lightNumItems\":" << ctx->light_cache_num_items << ",";
+    oss << "\"lightSize\":" << get_light_cache_size(ctx->light_cache_num_items) << ",";
+    oss << "\"dagNumItems\":" << ctx->full_dataset_num_items << ",";
+    oss << "\"dagSize\":" << get_full_dataset_size(ctx->full_dataset_num_items) << ",";
+    //  render as buffer items/hash512s
+    oss << "\"lightCache\":[";
+    for (unsigned i = 0; i < ctx->light_cache_num_items; ++i) {
+        oss << "\"0x" << toHex(ctx->light_cache[i].bytes) << "\",";
     }
-    *last_word_iter = 0x01;
-    *state_iter ^= to_le64(last_word);
+    long currpos = oss.tellp();
+    oss.seekp(currpos - 1);
+    oss << "]}";
+
+    info.GetReturnValue().Set(Nan::New(oss.str()).ToLocalChecked());
+}
+
+NAN_METHOD(getEpochContextBin) {
+    std::ostringstream oss;
+    int epoch_number = 0;
+    if (info[0]->IsNumber() && !getEpochNumber(info[0], epoch_number))
+        return Nan::ThrowRangeError(epoch_range_error);
+
+    // call get epoch context
+    epoch_context_ptr ctx = getSharedContext(epoch_number);
+    if (!ctx)
+        return;
+    current_ctx = ctx;
+    uint8_t buf[sizeof(epoch_context_full)];
+    
+    // FIXME: and bit align in CL
+    // check by recopying back to struct
+    memcpy(&buf, (const void*)ctx.get(), sizeof(epoch_context_full));
+
+    oss << "{\"bin\":[";
+    oss << "\"0x" << toHex(buf) << "\" ],";
+    oss << "\"lightNumItems\":" << ctx->light_cache_num_items << ",";
+    oss << "\"lightSize\":" << get_light_cache_size(ctx->light_cache_num_items) << ",";
+    oss << "\"dagSize\":" << get_full_dataset_size(ctx->full_dataset_num_items) << ",";
+    oss << "\"dagNumItems\":" << ctx->full_dataset_num_items << ",";
+    // oss << "\"lightCache\":[";
+    // for (unsigned i = 0; i < ctx->light_cache_num_items; ++i) {
+    //     oss << "\"0x" << toHex(ctx->light_cache[i].bytes) << "\",";
+    // }
+    long currpos = oss.tellp();
+    oss.seekp(currpos - 1);
+    // oss << "]}";
+    oss << "}";
 
-    state[(block_size / word_size) - 1] ^= 0x8000000000000000;
+    info.GetReturnValue().Set(Nan::New(oss.str()).ToLocalChecked());
+}
 
-    ethash_keccakf1600(state);
+NAN_METHOD(getLightCache) {
+    epoch_context_ptr ctx = current_ctx;
+    if (info[0]->IsNumber()) {
+        int epoch_number;
+        if (!getEpochNumber(info[0], epoch_number))
+            return Nan::ThrowRangeError(epoch_range_error);
+        ctx = getSharedContext(epoch_number);
+        if (!ctx)
+            return;
+    }
+    if (!ctx)
+        return Nan::ThrowError("no epoch context, call getEpochContextBin() first");
 
-    for (i = 0; i < (hash_size / word_size); ++i)
-        out[i] = to_le64(state[i]);
+    info.GetReturnValue().Set(Nan::CopyBuffer((const char*)ctx->light_cache,
+        get_light_cache_size(ctx->light_cache_num_items)).ToLocalChecked());
 }
 
-union hash256 ethash_keccak256(const uint8_t* data, size_t size)
-{
-    union hash256 hash;
-    keccak(hash.word64s, 256, data, size);
-    return hash;
+// verify(epoch, headerHash, nonce, mixHash, boundary)
+NAN_METHOD(verifyLight) {
+    hash256 header_hash, mix_hash, boundary;
+    uint64_t nonce;
+    int epoch_number;
+    if (!info[0]->IsNumber())
+        return Nan::ThrowTypeError("epoch must be a number");
+    if (!getEpochNumber(info[0], epoch_number))
+        return Nan::ThrowRangeError(epoch_range_error);
+    if (!getHash256(info[1], header_hash))
+        return Nan::ThrowTypeError("headerHash must be a 32-byte Buffer");
+    if (!getNonce(info[2], nonce))
+        return Nan::ThrowTypeError("nonce must be an 8-byte Buffer");
+    if (!getHash256(info[3], mix_hash))
+        return Nan::ThrowTypeError("mixHash must be a 32-byte Buffer");
+    if (!getHash256(info[4], boundary))
+        return Nan::ThrowTypeError("boundary must be a 32-byte Buffer");
+
+    epoch_context_ptr ctx = getSharedContext(epoch_number);
+    if (!ctx)
+        return;
+
+    info.GetReturnValue().Set(Nan::New<v8::Int32>(
+        static_cast<int>(verify(*ctx, header_hash, mix_hash, nonce, boundary))));
 }
 
-union hash256 ethash_keccak256_32(const uint8_t data[32])
-{
-    union hash256 hash;
-    keccak(hash.word64s, 256, data, 32);
-    return hash;
+NAN_METHOD(releaseEpochContext) {
+    int epoch_number = 0;
+    if (info[0]->IsNumber() && !getEpochNumber(info[0], epoch_number))
+        return Nan::ThrowRangeError(epoch_range_error);
+    shared_epoch_contexts().release(epoch_number);
 }
 
-union hash512 ethash_keccak512(const uint8_t* data, size_t size)
-{
-    union hash512 hash;
-    keccak(hash.word64s, 512, data, size);
-    return hash;
+// sealHashes(records) -> Buffer of 32-byte seal hashes, see seal_header_record
+NAN_METHOD(sealHashes) {
+    if (!node::Buffer::HasInstance(info[0]) ||
+        node::Buffer::Length(info[0]) % sizeof(seal_header_record) != 0)
+        return Nan::ThrowTypeError("records must be a Buffer of 568-byte records");
+
+    const size_t count = node::Buffer::Length(info[0]) / sizeof(seal_header_record);
+    const auto* records = reinterpret_cast<const seal_header_record*>(node::Buffer::Data(info[0]));
+
+    v8::Local<v8::Object> hashes = Nan::NewBuffer(static_cast<uint32_t>(count * sizeof(hash256))).ToLocalChecked();
+    const size_t invalid = seal_hashes(records, count,
+        reinterpret_cast<hash256*>(node::Buffer::Data(hashes)));
+    if (invalid != count) {
+        std::string message = "record " + std::to_string(invalid) + ": extra data longer than 32 bytes";
+        return Nan::ThrowRangeError(message.c_str());
+    }
+    info.GetReturnValue().Set(hashes);
 }
 
-union hash512 ethash_keccak512_64(const uint8_t data[64])
-{
-    union hash512 hash;
-    keccak(hash.word64s, 512, data, 64);
-    return hash;
+// Difficulty is a Number, or a big-endian Buffer of up to 32 bytes for
+// difficulties past 2^53.
+static bool getDifficulty(v8::Local<v8::Value> value, hash256& out) {
+    out = {};
+    if (value->IsNumber()) {
+        const double d = Nan::To<double>(value).FromJust();
+        if (!(d >= 0 && d < 18446744073709551616.0))
+            return false;
+        out.word64s[3] = be::uint64(static_cast<uint64_t>(d));
+        return true;
+    }
+    if (!node::Buffer::HasInstance(value) || node::Buffer::Length(value) > sizeof(out))
+        return false;
+    const size_t length = node::Buffer::Length(value);
+    memcpy(out.bytes + sizeof(out) - length, node::Buffer::Data(value), length);
+    return true;
 }
 
-inline hash512 bitwise_xor(const hash512& x, const hash512& y) noexcept
-{
-    hash512 z;
-    for (size_t i = 0; i < sizeof(z) / sizeof(z.word64s[0]); ++i)
-        z.word64s[i] = x.word64s[i] ^ y.word64s[i];
-    return z;
+NAN_METHOD(difficultyToBoundary) {
+    hash256 difficulty;
+    if (!getDifficulty(info[0], difficulty))
+        return Nan::ThrowTypeError("difficulty must be a non-negative number or a Buffer of up to 32 bytes");
+
+    const hash256 boundary = shared_boundary_cache().get(difficulty);
+    info.GetReturnValue().Set(Nan::CopyBuffer(boundary.str, sizeof(boundary)).ToLocalChecked());
 }
 
-struct le
-{
-    static uint32_t uint32(uint32_t x) noexcept { return x; }
-    static uint64_t uint64(uint64_t x) noexcept { return x; }
+NAN_METHOD(gradeShares) {
+    if (!node::Buffer::HasInstance(info[0]) || node::Buffer::Length(info[0]) % sizeof(hash256) != 0)
+        return Nan::ThrowTypeError("finalHashes must be a Buffer of 32-byte hashes");
+    if (!info[1]->IsArray())
+        return Nan::ThrowTypeError("difficulties must be an array");
+
+    v8::Local<v8::Array> difficulties = info[1].As<v8::Array>();
+    if (difficulties->Length() > max_share_targets)
+        return Nan::ThrowRangeError("at most 255 difficulties");
+
+    std::vector<hash256> boundaries(difficulties->Length());
+    for (uint32_t i = 0; i < boundaries.size(); ++i) {
+        hash256 difficulty;
+        if (!getDifficulty(Nan::Get(difficulties, i).ToLocalChecked(), difficulty)) {
+            std::string message = "difficulty " + std::to_string(i) + " must be a non-negative number or a Buffer of up to 32 bytes";
+            return Nan::ThrowTypeError(message.c_str());
+        }
+        boundaries[i] = shared_boundary_cache().get(difficulty);
+    }
 
-    static const hash1024& uint32s(const hash1024& h) noexcept { return h; }
-    static const hash512& uint32s(const hash512& h) noexcept { return h; }
-    static const hash256& uint32s(const hash256& h) noexcept { return h; }
-};
+    const size_t count = node::Buffer::Length(info[0]) / sizeof(hash256);
+    v8::Local<v8::Object> tiers = Nan::NewBuffer(static_cast<uint32_t>(count)).ToLocalChecked();
+    share_grader{boundaries.data(), boundaries.size()}.grade(
+        reinterpret_cast<const hash256*>(node::Buffer::Data(info[0])), count,
+        reinterpret_cast<uint8_t*>(node::Buffer::Data(tiers)));
+    info.GetReturnValue().Set(tiers);
+}
 
-struct item_state
-{
-    const hash512* const cache;
-    const int64_t num_cache_items;
-    const uint32_t seed;
+// Packed input record of verifyHeaders().
+constexpr static size_t header_record_size = 112;
+
+static header_to_verify parseHeaderRecord(const uint8_t* record) {
+    header_to_verify h;
+    uint32_t epoch;
+    uint64_t nonce;
+    memcpy(&epoch, record, sizeof(epoch));
+    memcpy(h.header_hash.bytes, record + 8, sizeof(h.header_hash));
+    memcpy(&nonce, record + 40, sizeof(nonce));
+    memcpy(h.mix_hash.bytes, record + 48, sizeof(h.mix_hash));
+    memcpy(h.boundary.bytes, record + 80, sizeof(h.boundary));
+    h.epoch_number = static_cast<int>(le::uint32(epoch));
+    h.nonce = be::uint64(nonce);
+    return h;
+}
 
-    hash512 mix;
+class VerifyHeadersWorker : public PoolWorker {
+public:
+    VerifyHeadersWorker(Nan::Callback* callback, v8::Local<v8::Object> records,
+        const verify_pipeline_options& options)
+      : PoolWorker(callback, "libeth:verifyHeaders", priority_interactive),
+        records_(reinterpret_cast<const uint8_t*>(node::Buffer::Data(records))),
+        num_records_(node::Buffer::Length(records) / header_record_size),
+        options_(options) {
+        SaveToPersistent("records", records);
+    }
 
-    item_state(const epoch_context& context, int64_t index) noexcept
-      : cache{context.light_cache},
-        num_cache_items{context.light_cache_num_items},
-        seed{static_cast<uint32_t>(index)}
-    {
-        mix = cache[index % num_cache_items];
-        mix.word32s[0] ^= le::uint32(seed);
-        mix = le::uint32s(ethash_keccak512_64(mix.bytes));
+    void Execute() override {
+        statuses_.resize(num_records_);
+        verify_pipeline pipeline(options_, [this](uint64_t index, int status) {
+            statuses_[index] = static_cast<int8_t>(status);
+        });
+        for (size_t i = 0; i < num_records_; ++i)
+            pipeline.push(parseHeaderRecord(records_ + i * header_record_size));
+        pipeline.finish();
+        contexts_built_ = pipeline.num_contexts_built();
+        max_live_contexts_ = pipeline.max_live_contexts();
     }
 
-    void update(uint32_t round) noexcept
-    {
-        static constexpr size_t num_words = sizeof(mix) / sizeof(uint32_t);
-        const uint32_t t = fnv1(seed ^ round, mix.word32s[round % num_words]);
-        const int64_t parent_index = t % num_cache_items;
-        mix = fnv1(mix, le::uint32s(cache[parent_index]));
+    void HandleOKCallback() override {
+        Nan::HandleScope scope;
+        v8::Local<v8::Object> stats = Nan::New<v8::Object>();
+        Nan::Set(stats, Nan::New("contextsBuilt").ToLocalChecked(),
+            Nan::New<v8::Uint32>(contexts_built_));
+        Nan::Set(stats, Nan::New("maxLiveContexts").ToLocalChecked(),
+            Nan::New<v8::Uint32>(max_live_contexts_));
+        v8::Local<v8::Value> argv[] = {Nan::Null(),
+            Nan::CopyBuffer(reinterpret_cast<const char*>(statuses_.data()),
+                statuses_.size()).ToLocalChecked(),
+            stats};
+        callback->Call(3, argv, async_resource);
     }
 
-    hash512 final() noexcept { return ethash_keccak512_64(le::uint32s(mix).bytes); }
+private:
+    const uint8_t* records_;
+    size_t num_records_;
+    verify_pipeline_options options_;
+    std::vector<int8_t> statuses_;
+    unsigned contexts_built_ = 0;
+    unsigned max_live_contexts_ = 0;
 };
 
-static int is_odd_prime(int number)
-{
-    int d;
+static unsigned getUintOption(v8::Local<v8::Object> options, const char* name, unsigned value) {
+    v8::Local<v8::Value> v = Nan::Get(options, Nan::New(name).ToLocalChecked()).ToLocalChecked();
+    return v->IsNumber() ? Nan::To<uint32_t>(v).FromJust() : value;
+}
 
-    /* Check factors up to sqrt(number).
-       To avoid computing sqrt, compare d*d <= number with 64-bit precision. */
-    for (d = 3; (int64_t)d * (int64_t)d <= (int64_t)number; d += 2)
-    {
-        if (number % d == 0)
-            return 0;
+// verifyHeaders(records, [options], callback(err, statuses, stats))
+NAN_METHOD(verifyHeaders) {
+    if (!node::Buffer::HasInstance(info[0]) ||
+        node::Buffer::Length(info[0]) % header_record_size != 0)
+        return Nan::ThrowTypeError("records must be a Buffer of 112-byte records");
+
+    verify_pipeline_options options;
+    int callback_arg = 1;
+    if (info[1]->IsObject() && !info[1]->IsFunction()) {
+        v8::Local<v8::Object> opts = info[1].As<v8::Object>();
+        options.lookahead = getUintOption(opts, "lookahead", options.lookahead);
+        if (options.lookahead > max_pipeline_lookahead) {
+            const std::string message =
+                "lookahead must be at most " + std::to_string(max_pipeline_lookahead);
+            return Nan::ThrowRangeError(message.c_str());
+        }
+        options.chunk_size = std::max(1u, getUintOption(opts, "chunkSize",
+            static_cast<unsigned>(options.chunk_size)));
+        callback_arg = 2;
     }
+    if (!info[callback_arg]->IsFunction())
+        return Nan::ThrowTypeError("callback must be a function");
 
-    return 1;
+    Nan::Callback* callback = new Nan::Callback(info[callback_arg].As<v8::Function>());
+    PoolWorker::Queue(new VerifyHeadersWorker(callback, info[0].As<v8::Object>(), options));
 }
 
-int find_largest_prime(int upper_bound)
-{
-    int n = upper_bound;
+class ValidateDagWorker : public PoolWorker {
+public:
+    ValidateDagWorker(Nan::Callback* callback, int epoch_number,
+        const dag_validation_options& options)
+      : PoolWorker(callback, "libeth:validateDag", priority_background),
+        epoch_number_(epoch_number), options_(options) {}
 
-    if (n < 2)
-        return 0;
-
-    if (n == 2)
-        return 2;
+    void SetFile(const std::string& path) {
+        path_ = path;
+    }
 
-    /* If even number, skip it. */
-    if (n % 2 == 0)
-        --n;
+    void SetBuffer(v8::Local<v8::Object> dag) {
+        SaveToPersistent("dag", dag);
+        dag_ = reinterpret_cast<const uint8_t*>(node::Buffer::Data(dag));
+        dag_size_ = node::Buffer::Length(dag);
+    }
 
-    /* Test descending odd numbers. */
-    while (!is_odd_prime(n))
-        n -= 2;
+    void Execute() override {
+        ctx_ = shared_epoch_contexts().get(epoch_number_);
+        if (!ctx_)
+            SetErrorMessage("cannot create epoch context (invalid epoch or out of memory)");
+    }
 
-    return n;
-}
+    // The samples are checked in chunked background tasks that give way to
+    // more urgent work, the last one completes the worker.
+    void Run() override {
+        Execute();
+        if (ErrorMessage())
+            return Complete();
+
+        options_.cancel = &Cancelled();
+        auto done = [this](const dag_validation_report& report) {
+            report_ = report;
+            ctx_.reset();
+            Complete();
+        };
+        if (dag_)
+            return validate_dag_async(ctx_, dag_, dag_size_, options_, done);
+        if (!validate_dag_file_async(ctx_, path_, options_, done)) {
+            std::string message = "cannot map " + path_ + ": " + strerror(errno);
+            SetErrorMessage(message.c_str());
+            Complete();
+        }
+    }
 
-int find_epoch_number(const hash256& seed) noexcept
-{
-    static constexpr int num_tries = 30000;  // Divisible by 16.
-
-    // Thread-local cache of the last search.
-    static thread_local int cached_epoch_number = 0;
-    static thread_local hash256 cached_seed = {};
-
-    // Load from memory once (memory will be clobbered by keccak256()).
-    const uint32_t seed_part = seed.word32s[0];
-    const int e = cached_epoch_number;
-    hash256 s = cached_seed;
-
-    if (s.word32s[0] == seed_part)
-        return e;
-
-    // Try the next seed, will match for sequential epoch access.
-    s = ethash_keccak256(s.bytes, 32);
-    if (s.word32s[0] == seed_part)
-    {
-        cached_seed = s;
-        cached_epoch_number = e + 1;
-        return e + 1;
-    }
-
-    // Search for matching seed starting from epoch 0.
-    s = {};
-    for (int i = 0; i < num_tries; ++i)
-    {
-        if (s.word32s[0] == seed_part)
-        {
-            cached_seed = s;
-            cached_epoch_number = i;
-            return i;
+    void HandleOKCallback() override {
+        Nan::HandleScope scope;
+        v8::Local<v8::Array> mismatches =
+            Nan::New<v8::Array>(static_cast<int>(report_.mismatches.size()));
+        for (size_t i = 0; i < report_.mismatches.size(); ++i) {
+            v8::Local<v8::Array> range = Nan::New<v8::Array>(2);
+            Nan::Set(range, 0, Nan::New<v8::Uint32>(report_.mismatches[i].first));
+            Nan::Set(range, 1, Nan::New<v8::Uint32>(report_.mismatches[i].last));
+            Nan::Set(mismatches, static_cast<uint32_t>(i), range);
         }
 
-        s = ethash_keccak256(s.bytes, 32);
+        v8::Local<v8::Object> report = Nan::New<v8::Object>();
+        Nan::Set(report, Nan::New("sizeOk").ToLocalChecked(), Nan::New<v8::Boolean>(report_.size_ok));
+        Nan::Set(report, Nan::New("itemsChecked").ToLocalChecked(),
+            Nan::New<v8::Number>(static_cast<double>(report_.items_checked)));
+        Nan::Set(report, Nan::New("itemsMismatched").ToLocalChecked(),
+            Nan::New<v8::Number>(static_cast<double>(report_.items_mismatched)));
+        Nan::Set(report, Nan::New("mismatches").ToLocalChecked(), mismatches);
+        Nan::Set(report, Nan::New("seconds").ToLocalChecked(), Nan::New<v8::Number>(report_.seconds));
+
+        v8::Local<v8::Value> argv[] = {Nan::Null(), report};
+        callback->Call(2, argv, async_resource);
     }
 
-    return -1;
-}
+private:
+    int epoch_number_;
+    dag_validation_options options_;
+    std::string path_;
+    const uint8_t* dag_ = nullptr;
+    size_t dag_size_ = 0;
+    epoch_context_ptr ctx_;
+    dag_validation_report report_;
+};
 
-hash256 calculate_epoch_seed(int epoch_number) noexcept
-{
-    hash256 epoch_seed = {};
-    for (int i = 0; i < epoch_number; ++i)
-        epoch_seed = ethash_keccak256_32(epoch_seed.bytes);
-    return epoch_seed;
+// validateDag(epoch, fileOrBuffer, [options], callback(err, report))
+NAN_METHOD(validateDag) {
+    int epoch_number;
+    if (!info[0]->IsNumber())
+        return Nan::ThrowTypeError("epoch must be a number");
+    if (!getEpochNumber(info[0], epoch_number))
+        return Nan::ThrowRangeError(epoch_range_error);
+    if (!info[1]->IsString() && !node::Buffer::HasInstance(info[1]))
+        return Nan::ThrowTypeError("dag must be a file name or a Buffer");
+
+    dag_validation_options options;
+    int callback_arg = 2;
+    if (info[2]->IsObject() && !info[2]->IsFunction()) {
+        v8::Local<v8::Object> opts = info[2].As<v8::Object>();
+        v8::Local<v8::Value> rate =
+            Nan::Get(opts, Nan::New("sampleRate").ToLocalChecked()).ToLocalChecked();
+        if (rate->IsNumber())
+            options.sample_rate = Nan::To<double>(rate).FromJust();
+        v8::Local<v8::Value> order =
+            Nan::Get(opts, Nan::New("order").ToLocalChecked()).ToLocalChecked();
+        if (order->IsString()) {
+            const std::string name = *Nan::Utf8String(order);
+            if (name == "random")
+                options.order = dag_sample_random;
+            else if (name == "strided")
+                options.order = dag_sample_strided;
+            else if (name == "full")
+                options.order = dag_sample_full;
+            else
+                return Nan::ThrowRangeError("order must be \"random\", \"strided\" or \"full\"");
+        }
+        options.num_threads = getUintOption(opts, "threads", options.num_threads);
+        options.seed = getUintOption(opts, "seed", static_cast<unsigned>(options.seed));
+        callback_arg = 3;
+    }
+    if (!info[callback_arg]->IsFunction())
+        return Nan::ThrowTypeError("callback must be a function");
+
+    Nan::Callback* callback = new Nan::Callback(info[callback_arg].As<v8::Function>());
+    ValidateDagWorker* worker =
+        new ValidateDagWorker(callback, epoch_number, options);
+    if (info[1]->IsString())
+        worker->SetFile(*Nan::Utf8String(info[1]));
+    else
+        worker->SetBuffer(info[1].As<v8::Object>());
+    PoolWorker::Queue(worker);
 }
 
-int calculate_light_cache_num_items(int epoch_number) noexcept
-{
-    static constexpr int item_size = sizeof(hash512);
-    static constexpr int num_items_init = light_cache_init_size / item_size;
-    static constexpr int num_items_growth = light_cache_growth / item_size;
-    static_assert(
-        light_cache_init_size % item_size == 0, "light_cache_init_size not multiple of item size");
-    static_assert(
-        light_cache_growth % item_size == 0, "light_cache_growth not multiple of item size");
-
-    int num_items_upper_bound = num_items_init + epoch_number * num_items_growth;
-    int num_items = find_largest_prime(num_items_upper_bound);
-    return num_items;
-}
+class PrepareContextWorker : public PoolWorker {
+public:
+    PrepareContextWorker(Nan::Callback* callback, int epoch_number, task_priority priority)
+      : PoolWorker(callback, "libeth:prepareEpochContext", priority), epoch_number_(epoch_number) {}
 
-int calculate_full_dataset_num_items(int epoch_number) noexcept
-{
-    static constexpr int item_size = sizeof(hash1024);
-    static constexpr int num_items_init = full_dataset_init_size / item_size;
-    static constexpr int num_items_growth = full_dataset_growth / item_size;
-    static_assert(full_dataset_init_size % item_size == 0,
-        "full_dataset_init_size not multiple of item size");
-    static_assert(
-        full_dataset_growth % item_size == 0, "full_dataset_growth not multiple of item size");
-
-    int num_items_upper_bound = num_items_init + epoch_number * num_items_growth;
-    int num_items = find_largest_prime(num_items_upper_bound);
-    return num_items;
-}
+    void Execute() override {
+        if (!shared_epoch_contexts().get(epoch_number_))
+            SetErrorMessage("cannot create epoch context (invalid epoch or out of memory)");
+    }
 
-hash2048 calculate_dataset_item_2048(const epoch_context& context, uint32_t index) noexcept
-{
-    item_state item0{context, int64_t(index) * 4};
-    item_state item1{context, int64_t(index) * 4 + 1};
-    item_state item2{context, int64_t(index) * 4 + 2};
-    item_state item3{context, int64_t(index) * 4 + 3};
+private:
+    int epoch_number_;
+};
 
-    for (uint32_t j = 0; j < full_dataset_item_parents; ++j)
-    {
-        item0.update(j);
-        item1.update(j);
-        item2.update(j);
-        item3.update(j);
+// prepareEpochContext(epoch, [options], callback(err)): builds the context
+// into the registry without blocking the event loop. With { ahead: true } it
+// is pregenerated at the priority below current-epoch builds.
+NAN_METHOD(prepareEpochContext) {
+    int epoch_number;
+    if (!info[0]->IsNumber())
+        return Nan::ThrowTypeError("epoch must be a number");
+    if (!getEpochNumber(info[0], epoch_number))
+        return Nan::ThrowRangeError(epoch_range_error);
+
+    task_priority priority = priority_current_epoch;
+    int callback_arg = 1;
+    if (info[1]->IsObject() && !info[1]->IsFunction()) {
+        v8::Local<v8::Value> ahead =
+            Nan::Get(info[1].As<v8::Object>(), Nan::New("ahead").ToLocalChecked()).ToLocalChecked();
+        if (Nan::To<bool>(ahead).FromJust())
+            priority = priority_next_epoch;
+        callback_arg = 2;
     }
+    if (!info[callback_arg]->IsFunction())
+        return Nan::ThrowTypeError("callback must be a function");
 
-    return hash2048{{item0.final(), item1.final(), item2.final(), item3.final()}};
+    Nan::Callback* callback = new Nan::Callback(info[callback_arg].As<v8::Function>());
+    PoolWorker::Queue(new PrepareContextWorker(callback, epoch_number, priority));
 }
 
-inline constexpr size_t get_light_cache_size(int num_items) noexcept
-{
-    return static_cast<size_t>(num_items) * ETHASH_LIGHT_CACHE_ITEM_SIZE; //light_cache_item_size;
+// configureThreadPool({ threads, cpus }): sizes the native pool shared by all
+// isolates. Only possible before the first heavy call starts it.
+NAN_METHOD(configureThreadPool) {
+    if (!info[0]->IsObject())
+        return Nan::ThrowTypeError("options must be an object");
+
+    v8::Local<v8::Object> opts = info[0].As<v8::Object>();
+    thread_pool_options options;
+    options.num_threads = getUintOption(opts, "threads", options.num_threads);
+    v8::Local<v8::Value> cpus = Nan::Get(opts, Nan::New("cpus").ToLocalChecked()).ToLocalChecked();
+    if (cpus->IsArray()) {
+        v8::Local<v8::Array> list = cpus.As<v8::Array>();
+        for (uint32_t i = 0; i < list->Length(); ++i)
+            options.cpus.push_back(Nan::To<int32_t>(Nan::Get(list, i).ToLocalChecked()).FromJust());
+    }
+
+    if (!configure_shared_thread_pool(options))
+        return Nan::ThrowError("the thread pool is already running");
 }
 
-inline constexpr uint64_t get_full_dataset_size(int num_items) noexcept
-{
-    return static_cast<uint64_t>(num_items) * ETHASH_FULL_DATASET_ITEM_SIZE;
+static void setNumber(v8::Local<v8::Object> obj, const char* name, double value) {
+    Nan::Set(obj, Nan::New(name).ToLocalChecked(), Nan::New<v8::Number>(value));
 }
 
-void build_light_cache(
-    hash512 cache[], int num_items, const hash256& seed) noexcept
-{
-    hash512 item = ethash_keccak512(seed.bytes, sizeof(seed));
-    cache[0] = item;
-    for (int i = 1; i < num_items; ++i)
-    {
-        item = ethash_keccak512(item.bytes, sizeof(item));
-        cache[i] = item;
+// getThreadPoolStats(): queue depth and wait times per priority class.
+NAN_METHOD(getThreadPoolStats) {
+    static const char* const class_names[num_task_priorities] = {
+        "interactive", "currentEpoch", "nextEpoch", "background"};
+
+    const thread_pool_stats stats = shared_thread_pool().stats();
+    v8::Local<v8::Object> result = Nan::New<v8::Object>();
+    setNumber(result, "threads", stats.num_threads);
+    setNumber(result, "steals", static_cast<double>(stats.steals));
+    for (int p = 0; p < num_task_priorities; ++p) {
+        const thread_pool_stats::priority_class& c = stats.classes[p];
+        const uint64_t started = c.submitted - c.queued;
+        v8::Local<v8::Object> o = Nan::New<v8::Object>();
+        setNumber(o, "queued", static_cast<double>(c.queued));
+        setNumber(o, "submitted", static_cast<double>(c.submitted));
+        setNumber(o, "completed", static_cast<double>(c.completed));
+        setNumber(o, "avgWaitMs", started ? c.total_wait_ns / 1e6 / started : 0);
+        setNumber(o, "maxWaitMs", c.max_wait_ns / 1e6);
+        Nan::Set(result, Nan::New(class_names[p]).ToLocalChecked(), o);
     }
+    info.GetReturnValue().Set(result);
+}
 
-    for (int q = 0; q < light_cache_rounds; ++q)
-    {
-        for (int i = 0; i < num_items; ++i)
-        {
-            const uint32_t index_limit = static_cast<uint32_t>(num_items);
-
-            // Fist index: 4 first bytes of the item as little-endian integer.
-            const uint32_t t = le::uint32(cache[i].word32s[0]);
-            const uint32_t v = t % index_limit;
+using v8::FunctionTemplate;
 
-            // Second index.
-            const uint32_t w = static_cast<uint32_t>(num_items + (i - 1)) % index_limit;
+// Client of a libeth-verifyd service on this machine.
+//
+//   var client = new ethlib.VerifyClient("/libeth-verify")
+//   client.submit(tag, epoch, headerHash, nonce, mixHash)  // false when queue is full
+//   client.wait(timeoutMs, function (err, ready) { var results = client.poll() })
+class VerifyClient : public Nan::ObjectWrap {
+public:
+    static NAN_MODULE_INIT(Init) {
+        v8::Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
+        tpl->SetClassName(Nan::New("VerifyClient").ToLocalChecked());
+        tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+        Nan::SetPrototypeMethod(tpl, "submit", Submit);
+        Nan::SetPrototypeMethod(tpl, "poll", Poll);
+        Nan::SetPrototypeMethod(tpl, "wait", Wait);
+        Nan::SetPrototypeMethod(tpl, "close", Close);
+
+        Nan::Set(target, Nan::New("VerifyClient").ToLocalChecked(),
+        Nan::GetFunction(tpl).ToLocalChecked());
+    }
 
-            const hash512 x = bitwise_xor(cache[v], cache[w]);
-            cache[i] = ethash_keccak512(x.bytes, sizeof(x));
+private:
+    // Checks the response queue from a timer of the isolate's own loop, so a
+    // waiting client holds no libuv threadpool thread. The environment cleanup
+    // hook closes the timer when a worker thread goes away mid-wait.
+    class Waiter {
+    public:
+        static void Start(Nan::Callback* callback, std::shared_ptr<verify_client> client,
+            int timeout_ms) {
+            Waiter* w = new Waiter(callback, std::move(client));
+            w->deadline_ = uv_now(Nan::GetCurrentEventLoop()) + std::max(timeout_ms, 0);
+            uv_timer_init(Nan::GetCurrentEventLoop(), &w->timer_);
+            w->timer_.data = w;
+            uv_timer_start(&w->timer_, OnTimer, 0, 1);
+            node::AddEnvironmentCleanupHook(w->isolate_, OnCleanup, w);
         }
-    }
-}
 
-epoch_context_full* create_epoch_context(
-    int epoch_number, bool full) noexcept
-{
-    static_assert(sizeof(epoch_context_full) < sizeof(hash512), "epoch_context too big");
-    static constexpr size_t context_alloc_size = sizeof(hash512);
-
-    // TODO - iquidus
-    int epoch_ecip1099 = epoch_number;
-    if (epoch_number >= ecip_1099_activation_epoch)
-    {
-        // note, int truncates, it doesnt round, 10 == 10.5. So this is ok.
-        epoch_ecip1099 = epoch_number/2;
-    }
-
-    const int light_cache_num_items = calculate_light_cache_num_items(epoch_ecip1099);
-    const int full_dataset_num_items = calculate_full_dataset_num_items(epoch_ecip1099);
-    const size_t light_cache_size = get_light_cache_size(light_cache_num_items);
-    const size_t full_dataset_size =
-        full ? static_cast<size_t>(full_dataset_num_items) * sizeof(hash1024) :
-               l1_cache_size;
-
-    const size_t alloc_size = context_alloc_size + light_cache_size + full_dataset_size;
-
-    char* const alloc_data = static_cast<char*>(std::calloc(1, alloc_size));
-    if (!alloc_data)
-        return nullptr;  // Signal out-of-memory by returning null pointer.
-
-    hash512* const light_cache = reinterpret_cast<hash512*>(alloc_data + context_alloc_size);
-    const hash256 epoch_seed = calculate_epoch_seed(epoch_number);
-    build_light_cache(light_cache, light_cache_num_items, epoch_seed);
-
-    uint32_t* const l1_cache =
-        reinterpret_cast<uint32_t*>(alloc_data + context_alloc_size + light_cache_size);
-
-    hash1024* full_dataset = full ? reinterpret_cast<hash1024*>(l1_cache) : nullptr;
-
-    epoch_context_full* const context = new (alloc_data) epoch_context_full{
-        epoch_number,
-        light_cache_num_items,
-        light_cache,
-        l1_cache,
-        full_dataset_num_items,
-        full_dataset,
-    };
+    private:
+        Waiter(Nan::Callback* callback, std::shared_ptr<verify_client> client)
+          : callback_(callback), client_(std::move(client)),
+            isolate_(v8::Isolate::GetCurrent()), resource_("libeth:VerifyClient.wait") {}
 
-    auto* full_dataset_2048 = reinterpret_cast<hash2048*>(l1_cache);
-    for (uint32_t i = 0; i < l1_cache_size / sizeof(full_dataset_2048[0]); ++i)
-        full_dataset_2048[i] = calculate_dataset_item_2048(*context, i);
-    return context;
-}
+        ~Waiter() {
+            delete callback_;
+        }
 
-template <class T>
-std::string toHex(T const& _data, int _w = 2)
-{
-    std::ostringstream ret;
-    unsigned ii = 0;
-    for (auto i : _data)
-        ret << std::hex << std::setfill('0') << std::setw(ii++ ? 2 : _w)
-            << (int)(typename std::make_unsigned<decltype(i)>::type)i;
-    return ret.str();
-}
+        static void OnTimer(uv_timer_t* timer) {
+            Waiter* w = static_cast<Waiter*>(timer->data);
+            const bool ready = w->client_->ready();
+            if (!ready && uv_now(timer->loop) < w->deadline_)
+                return;
+
+            w->Close();
+            Nan::HandleScope scope;
+            v8::Local<v8::Value> argv[] = {Nan::Null(), Nan::New<v8::Boolean>(ready)};
+            w->callback_->Call(2, argv, &w->resource_);
+            // Freed by the close callback, after the call.
+        }
 
-NAN_METHOD(echo) {
-    std::ostringstream oss;
-    oss << "a + " << "b";
-    info.GetReturnValue().Set(Nan::New(oss.str()).ToLocalChecked());
-}
+        static void OnCleanup(void* arg) {
+            static_cast<Waiter*>(arg)->Close();
+        }
 
-struct epoch_context_full* ctx;
+        void Close() {
+            node::RemoveEnvironmentCleanupHook(isolate_, OnCleanup, this);
+            uv_timer_stop(&timer_);
+            uv_close(reinterpret_cast<uv_handle_t*>(&timer_), [](uv_handle_t* h) {
+                delete static_cast<Waiter*>(h->data);
+            });
+        }
 
-NAN_METHOD(getEpochContext) {
-    std::ostringstream oss;
-    double d = info[0]->IsNumber() ? Nan::To<double>(info[0]).FromJust() : 0;
-    
-    // std::cout << "Epoch: " << d;
+        Nan::Callback* callback_;
+        std::shared_ptr<verify_client> client_;
+        v8::Isolate* isolate_;
+        Nan::AsyncResource resource_;
+        uv_timer_t timer_;
+        uint64_t deadline_ = 0;
+    };
 
-    // call get epoch context
-    struct epoch_context_full* ctx = create_epoch_context(d, false);
+    explicit VerifyClient(std::shared_ptr<verify_client> client) : client_(std::move(client)) {}
 
-    oss << "{";
-    oss << "\"epochNumber\":" << ctx->epoch_number << ",";
-    oss << "\"lightNumItems\":" << ctx->light_cache_num_items << ",";
-    oss << "\"lightSize\":" << get_light_cache_size(ctx->light_cache_num_items) << ",";
-    oss << "\"dagNumItems\":" << ctx->full_dataset_num_items << ",";
-    oss << "\"dagSize\":" << get_full_dataset_size(ctx->full_dataset_num_items) << ",";
-    //  render as buffer items/hash512s
-    oss << "\"lightCache\":[";
-    for (unsigned i = 0; i < ctx->light_cache_num_items; ++i) {
-        oss << "\"0x" << toHex(ctx->light_cache[i].bytes) << "\",";
+    static VerifyClient* Connected(Nan::NAN_METHOD_ARGS_TYPE info) {
+        VerifyClient* self = Nan::ObjectWrap::Unwrap<VerifyClient>(info.Holder());
+        if (!self->client_) {
+            Nan::ThrowError("VerifyClient is closed");
+            return nullptr;
+        }
+        return self;
     }
-    long currpos = oss.tellp();
-    oss.seekp(currpos - 1);
-    oss << "]}";
 
-    info.GetReturnValue().Set(Nan::New(oss.str()).ToLocalChecked());
-}
+    static NAN_METHOD(New) {
+        if (!info.IsConstructCall())
+            return Nan::ThrowError("VerifyClient must be called with new");
 
-NAN_METHOD(getEpochContextBin) {
-    std::ostringstream oss;
-    double d = info[0]->IsNumber() ? Nan::To<double>(info[0]).FromJust() : 0;
-    
-    // std::cout << "Epoch: " << d;
+        std::string name = "/libeth-verify";
+        if (info[0]->IsString())
+            name = *Nan::Utf8String(info[0]);
 
-    // call get epoch context
-    ctx = create_epoch_context(d, false);
-    ctx->full_dataset = nullptr;
-    // ctx->epoch_number = 455;
-    uint8_t buf[sizeof(epoch_context_full)];
-    
-    // FIXME: and bit align in CL
-    // check by recopying back to struct
-    memcpy(&buf, (void*)ctx, sizeof(epoch_context_full));
+        std::shared_ptr<verify_client> client = verify_client::connect(name);
+        if (!client) {
+            std::string message = "cannot connect to " + name + ": " + strerror(errno);
+            return Nan::ThrowError(message.c_str());
+        }
 
-    oss << "{\"bin\":[";
-    oss << "\"0x" << toHex(buf) << "\" ],";
-    oss << "\"lightNumItems\":" << ctx->light_cache_num_items << ",";
-    oss << "\"lightSize\":" << get_light_cache_size(ctx->light_cache_num_items) << ",";
-    oss << "\"dagSize\":" << get_full_dataset_size(ctx->full_dataset_num_items) << ",";
-    oss << "\"dagNumItems\":" << ctx->full_dataset_num_items << ",";
-    // oss << "\"lightCache\":[";
-    // for (unsigned i = 0; i < ctx->light_cache_num_items; ++i) {
-    //     oss << "\"0x" << toHex(ctx->light_cache[i].bytes) << "\",";
-    // }
-    long currpos = oss.tellp();
-    oss.seekp(currpos - 1);
-    // oss << "]}";
-    oss << "}";
+        VerifyClient* self = new VerifyClient(std::move(client));
+        self->Wrap(info.This());
+        info.GetReturnValue().Set(info.This());
+    }
 
-    info.GetReturnValue().Set(Nan::New(oss.str()).ToLocalChecked());
-}
+    // submit(tag, epoch, headerHash, nonce, mixHash)
+    static NAN_METHOD(Submit) {
+        VerifyClient* self = Connected(info);
+        if (!self)
+            return;
+
+        hash256 header_hash, mix_hash;
+        uint64_t nonce;
+        int epoch;
+        if (!info[0]->IsNumber() || !info[1]->IsNumber())
+            return Nan::ThrowTypeError("tag and epoch must be numbers");
+        if (!getEpochNumber(info[1], epoch))
+            return Nan::ThrowRangeError(epoch_range_error);
+        if (!getHash256(info[2], header_hash))
+            return Nan::ThrowTypeError("headerHash must be a 32-byte Buffer");
+        if (!getNonce(info[3], nonce))
+            return Nan::ThrowTypeError("nonce must be an 8-byte Buffer");
+        if (!getHash256(info[4], mix_hash))
+            return Nan::ThrowTypeError("mixHash must be a 32-byte Buffer");
+
+        const uint64_t tag = static_cast<uint64_t>(Nan::To<double>(info[0]).FromJust());
+        info.GetReturnValue().Set(Nan::New<v8::Boolean>(
+            self->client_->submit(tag, epoch, header_hash, nonce, mix_hash)));
+    }
 
-NAN_METHOD(getLightCache) {
-    info.GetReturnValue().Set(Nan::CopyBuffer((char*)ctx->light_cache, 
-        ctx->light_cache_num_items * 64).ToLocalChecked());
-}
+    // poll([max]) -> [{tag, epoch, status, finalHash}]
+    static NAN_METHOD(Poll) {
+        VerifyClient* self = Connected(info);
+        if (!self)
+            return;
+
+        const size_t max_responses = info[0]->IsNumber() ?
+            static_cast<size_t>(Nan::To<double>(info[0]).FromJust()) : SIZE_MAX;
+        std::vector<verify_response> responses;
+        self->client_->poll(responses, max_responses);
+
+        v8::Local<v8::Array> results = Nan::New<v8::Array>(static_cast<int>(responses.size()));
+        for (size_t i = 0; i < responses.size(); ++i) {
+            const verify_response& r = responses[i];
+            v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+            Nan::Set(obj, Nan::New("tag").ToLocalChecked(),
+                Nan::New<v8::Number>(static_cast<double>(r.tag)));
+            Nan::Set(obj, Nan::New("epoch").ToLocalChecked(), Nan::New<v8::Int32>(r.epoch_number));
+            Nan::Set(obj, Nan::New("status").ToLocalChecked(), Nan::New<v8::Int32>(r.status));
+            Nan::Set(obj, Nan::New("finalHash").ToLocalChecked(),
+                Nan::CopyBuffer(r.final_hash.str, sizeof(r.final_hash)).ToLocalChecked());
+            Nan::Set(results, static_cast<uint32_t>(i), obj);
+        }
+        info.GetReturnValue().Set(results);
+    }
 
-using v8::FunctionTemplate;
+    // wait(timeoutMs, callback(err, ready))
+    static NAN_METHOD(Wait) {
+        VerifyClient* self = Connected(info);
+        if (!self)
+            return;
+        if (!info[0]->IsNumber() || !info[1]->IsFunction())
+            return Nan::ThrowTypeError("wait(timeoutMs, callback)");
+
+        Nan::Callback* callback = new Nan::Callback(info[1].As<v8::Function>());
+        Waiter::Start(callback, self->client_, Nan::To<int32_t>(info[0]).FromJust());
+    }
+
+    static NAN_METHOD(Close) {
+        VerifyClient* self = Nan::ObjectWrap::Unwrap<VerifyClient>(info.Holder());
+        self->client_.reset();
+    }
+
+    std::shared_ptr<verify_client> client_;
+};
 
 NAN_MODULE_INIT(InitAll) {
     Nan::Set(target, Nan::New("echo").ToLocalChecked(),
@@ -830,6 +922,39 @@ NAN_MODULE_INIT(InitAll) {
     Nan::Set(target, Nan::New("getLightCache").ToLocalChecked(),
     Nan::GetFunction(Nan::New<FunctionTemplate>(getLightCache)).ToLocalChecked());
 
+    Nan::Set(target, Nan::New("verify").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(verifyLight)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("releaseEpochContext").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(releaseEpochContext)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("sealHashes").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(sealHashes)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("difficultyToBoundary").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(difficultyToBoundary)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("gradeShares").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(gradeShares)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("prepareEpochContext").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(prepareEpochContext)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("configureThreadPool").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(configureThreadPool)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("getThreadPoolStats").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(getThreadPoolStats)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("verifyHeaders").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(verifyHeaders)).ToLocalChecked());
+
+    Nan::Set(target, Nan::New("validateDag").ToLocalChecked(),
+    Nan::GetFunction(Nan::New<FunctionTemplate>(validateDag)).ToLocalChecked());
+
+    VerifyClient::Init(target);
 }
 
-NODE_MODULE(libeth, InitAll)
\ No newline at end of file
+// Context-aware: safe to require() from worker_threads, all instances share
+// shared_epoch_contexts().
+NAN_MODULE_WORKER_ENABLED(libeth, InitAll)
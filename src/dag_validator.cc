@@ -0,0 +1,290 @@
+// Sampled recomputation of externally generated DAGs.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include "dag_validator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include "parallel.h"
+
+static uint64_t splitmix64(uint64_t x) noexcept
+{
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+namespace
+{
+/**
+ * Keyed bijection of [0, size): a 4-round Feistel network over the smallest
+ * even number of bits covering size, cycle-walked back into range. The
+ * first n outputs are n distinct pairs, sampling without replacement.
+ */
+class pair_permutation
+{
+public:
+    pair_permutation(uint64_t size, uint64_t seed) noexcept : size_{size}
+    {
+        while ((uint64_t{1} << (2 * half_bits_)) < size_)
+            ++half_bits_;
+        mask_ = (uint64_t{1} << half_bits_) - 1;
+        for (unsigned r = 0; r < num_rounds; ++r)
+            keys_[r] = splitmix64(seed + r);
+    }
+
+    uint64_t operator()(uint64_t x) const noexcept
+    {
+        // The domain is less than 4 * size, so this loops 4 times at most on average.
+        do
+            x = encrypt(x);
+        while (x >= size_);
+        return x;
+    }
+
+private:
+    static constexpr unsigned num_rounds = 4;
+
+    uint64_t encrypt(uint64_t x) const noexcept
+    {
+        uint64_t left = x >> half_bits_;
+        uint64_t right = x & mask_;
+        for (unsigned r = 0; r < num_rounds; ++r)
+        {
+            const uint64_t next = left ^ (splitmix64(right ^ keys_[r]) & mask_);
+            left = right;
+            right = next;
+        }
+        return (left << half_bits_) | right;
+    }
+
+    const uint64_t size_;
+    unsigned half_bits_ = 1;
+    uint64_t mask_ = 0;
+    uint64_t keys_[num_rounds] = {};
+};
+
+/** Sampling plan of one validation, and what the checks found so far. */
+class dag_sampler
+{
+public:
+    dag_sampler(const epoch_context& context, const uint8_t* dag, uint64_t dag_size,
+        const dag_validation_options& options) noexcept
+      : context_{context},
+        dag_{dag},
+        order_{options.order},
+        cancel_{options.cancel},
+        expected_size_{get_full_dataset_size(context.full_dataset_num_items)},
+        size_ok_{dag_size == expected_size_},
+        // calculate_dataset_item_2048() gives items 2p and 2p + 1 for pair p,
+        // an odd item count leaves a single item in the last pair.
+        num_items_{std::min(expected_size_, dag_size) / sizeof(hash1024)},
+        num_pairs_{(num_items_ + 1) / 2},
+        permutation_{num_pairs_, options.seed}
+    {
+        num_samples_ = num_pairs_;
+        if (order_ != dag_sample_full)
+        {
+            const double rate = std::min(1.0, std::max(0.0, options.sample_rate));
+            num_samples_ = std::min(num_pairs_,
+                std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(rate * num_pairs_))));
+        }
+        if (num_pairs_ == 0)
+            num_samples_ = 0;
+
+        stride_ = num_samples_ ? num_pairs_ / num_samples_ : 1;
+        offset_ = stride_ > 1 ? splitmix64(options.seed) % stride_ : 0;
+    }
+
+    uint64_t num_samples() const noexcept { return num_samples_; }
+
+    /** Recomputes sample i and compares it with the dump, from any thread. */
+    void check(uint64_t i)
+    {
+        if (cancel_ && cancel_->load(std::memory_order_relaxed))
+            return;
+
+        uint64_t pair = i;
+        if (order_ == dag_sample_random)
+            pair = permutation_(i);
+        else if (order_ == dag_sample_strided)
+            pair = i * stride_ + offset_;
+
+        const hash2048 expected =
+            calculate_dataset_item_2048(context_, static_cast<uint32_t>(pair));
+        const uint64_t first_item = pair * 2;
+        const unsigned items = first_item + 1 < num_items_ ? 2 : 1;
+        items_checked_.fetch_add(items, std::memory_order_relaxed);
+
+        for (unsigned k = 0; k < items; ++k)
+        {
+            const uint8_t* const actual = dag_ + (first_item + k) * sizeof(hash1024);
+            if (memcmp(actual, expected.bytes + k * sizeof(hash1024), sizeof(hash1024)) != 0)
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                mismatched_.push_back(static_cast<uint32_t>(first_item + k));
+            }
+        }
+    }
+
+    /** Report of the checks done, once they have all returned. */
+    dag_validation_report finish()
+    {
+        dag_validation_report report;
+        report.size_ok = size_ok_;
+
+        std::sort(mismatched_.begin(), mismatched_.end());
+        mismatched_.erase(std::unique(mismatched_.begin(), mismatched_.end()), mismatched_.end());
+        for (const uint32_t item : mismatched_)
+        {
+            if (!report.mismatches.empty() && report.mismatches.back().last + 1 == item)
+                report.mismatches.back().last = item;
+            else
+                report.mismatches.push_back({item, item});
+        }
+
+        report.items_checked = items_checked_;
+        report.items_mismatched = mismatched_.size();
+        report.seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        return report;
+    }
+
+private:
+    const std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+    const epoch_context& context_;
+    const uint8_t* const dag_;
+    const dag_sample_order order_;
+    const std::atomic<bool>* const cancel_;
+    const uint64_t expected_size_;
+    const bool size_ok_;
+    const uint64_t num_items_;
+    const uint64_t num_pairs_;
+    const pair_permutation permutation_;
+    uint64_t num_samples_ = 0;
+    uint64_t stride_ = 1;
+    uint64_t offset_ = 0;
+
+    std::mutex mutex_;
+    std::vector<uint32_t> mismatched_;
+    std::atomic<uint64_t> items_checked_{0};
+};
+
+/** Maps a dump read-only, nullptr for an empty file. False and errno on failure. */
+bool map_dump(const std::string& path, dag_sample_order order, void*& mem, uint64_t& size)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        const int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return false;
+    }
+
+    size = static_cast<uint64_t>(st.st_size);
+    mem = nullptr;
+    if (size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const int saved_errno = errno;
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        errno = saved_errno;
+        return false;
+    }
+
+    // Only sampled pages are worth reading in.
+    madvise(mem, size, order == dag_sample_full ? MADV_SEQUENTIAL : MADV_RANDOM);
+    return true;
+}
+
+// Samples handed out at a time.
+constexpr uint64_t sample_grain = 64;
+}  // namespace
+
+dag_validation_report validate_dag(const epoch_context& context, const uint8_t* dag,
+    uint64_t dag_size, const dag_validation_options& options)
+{
+    dag_sampler sampler{context, dag, dag_size, options};
+    parallel_for(priority_background, 0, sampler.num_samples(), options.num_threads, sample_grain,
+        [&](uint64_t i) { sampler.check(i); });
+    return sampler.finish();
+}
+
+bool validate_dag_file(const epoch_context& context, const std::string& path,
+    const dag_validation_options& options, dag_validation_report& report)
+{
+    void* mem;
+    uint64_t size;
+    if (!map_dump(path, options.order, mem, size))
+        return false;
+
+    report = validate_dag(context, static_cast<const uint8_t*>(mem), size, options);
+    if (mem)
+        munmap(mem, size);
+    return true;
+}
+
+void validate_dag_async(epoch_context_ptr context, const uint8_t* dag, uint64_t dag_size,
+    const dag_validation_options& options, dag_validation_callback done)
+{
+    auto sampler = std::make_shared<dag_sampler>(*context, dag, dag_size, options);
+    const uint64_t num_samples = sampler->num_samples();
+    parallel_for_async(priority_background, 0, num_samples, options.num_threads, sample_grain,
+        [sampler](uint64_t i) { sampler->check(i); },
+        [sampler, context, done] { done(sampler->finish()); });
+}
+
+bool validate_dag_file_async(epoch_context_ptr context, const std::string& path,
+    const dag_validation_options& options, dag_validation_callback done)
+{
+    void* mem;
+    uint64_t size;
+    if (!map_dump(path, options.order, mem, size))
+        return false;
+
+    validate_dag_async(std::move(context), static_cast<const uint8_t*>(mem), size, options,
+        [mem, size, done](const dag_validation_report& report) {
+            if (mem)
+                munmap(mem, size);
+            done(report);
+        });
+    return true;
+}
@@ -0,0 +1,90 @@
+/**
+ * Spot checks of externally generated DAGs (e.g. dumped from a GPU) by
+ * recomputing a sample of the items from the light cache.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ethash.h"
+
+enum dag_sample_order
+{
+    dag_sample_random = 0,  // Pseudo-random items, each checked once.
+    dag_sample_strided = 1,  // Evenly spaced items from a random offset.
+    dag_sample_full = 2,  // Every item, sample_rate is ignored.
+};
+
+struct dag_validation_options
+{
+    double sample_rate = 0.01;  // Fraction of items to recompute, (0, 1].
+    dag_sample_order order = dag_sample_random;
+    unsigned num_threads = 0;  // 0: the whole shared pool.
+    uint64_t seed = 0;  // Picks the random items or the strided offset.
+    const std::atomic<bool>* cancel = nullptr;  // Once set, the remaining items are skipped.
+};
+
+/** Inclusive range of 128-byte dataset item indexes. */
+struct dag_item_range
+{
+    uint32_t first;
+    uint32_t last;
+};
+
+struct dag_validation_report
+{
+    bool size_ok = false;  // Dump is exactly the epoch's dataset size.
+    uint64_t items_checked = 0;
+    uint64_t items_mismatched = 0;
+    std::vector<dag_item_range> mismatches;  // Sorted, adjacent items merged.
+    double seconds = 0;
+};
+
+/**
+ * Recomputes the sampled items of the dump, two at a time with
+ * calculate_dataset_item_2048(), on the shared pool at priority_background.
+ * A short dump is checked up to its last complete item.
+ */
+dag_validation_report validate_dag(const epoch_context& context, const uint8_t* dag,
+    uint64_t dag_size, const dag_validation_options& options);
+
+/** Same for a dump file, mapped read-only. False and errno if it cannot be mapped. */
+bool validate_dag_file(const epoch_context& context, const std::string& path,
+    const dag_validation_options& options, dag_validation_report& report);
+
+using dag_validation_callback = std::function<void(const dag_validation_report&)>;
+
+/**
+ * validate_dag() that returns at once and calls done with the report on the
+ * pool thread checking the last item (see parallel_for_async()), so no
+ * thread waits for the whole dump. dag must stay valid until then.
+ */
+void validate_dag_async(epoch_context_ptr context, const uint8_t* dag, uint64_t dag_size,
+    const dag_validation_options& options, dag_validation_callback done);
+
+/**
+ * Same for a dump file, unmapped before done is called. False and errno if
+ * it cannot be mapped, done is not called then.
+ */
+bool validate_dag_file_async(epoch_context_ptr context, const std::string& path,
+    const dag_validation_options& options, dag_validation_callback done);
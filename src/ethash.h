@@ -0,0 +1,231 @@
+/**
+ * Ethash/Etchash core: hash types, epoch contexts and light verification.
+ * The code mostly stripped from cpp-etchash
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <cstring>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "thread_pool.h"
+
+constexpr static int light_cache_init_size = 1 << 24;
+constexpr static int light_cache_growth = 1 << 17;
+constexpr static int light_cache_rounds = 3;
+constexpr static int full_dataset_init_size = 1 << 30;
+constexpr static int full_dataset_growth = 1 << 23;
+constexpr static int full_dataset_item_parents = 256;
+constexpr static int num_dataset_accesses = 64;
+constexpr static int ecip_1099_activation_epoch = 390; // classic mainnet
+constexpr size_t l1_cache_size = 16 * 1024;
+
+#define ETHASH_LIGHT_CACHE_ITEM_SIZE 64
+#define ETHASH_FULL_DATASET_ITEM_SIZE 128
+
+union hash256
+{
+    uint64_t word64s[4];
+    uint32_t word32s[8];
+    uint8_t bytes[32];
+    char str[32];
+};
+
+union hash512
+{
+    uint64_t word64s[8];
+    uint32_t word32s[16];
+    uint8_t bytes[64];
+    char str[64];
+};
+
+union hash1024
+{
+    union hash512 hash512s[2];
+    uint64_t word64s[16];
+    uint32_t word32s[32];
+    uint8_t bytes[128];
+    char str[128];
+};
+
+union hash2048
+{
+    union hash512 hash512s[4];
+    uint64_t word64s[32];
+    uint32_t word32s[64];
+    uint8_t bytes[256];
+    char str[256];
+};
+
+struct result
+{
+    union hash256 final_hash;
+    union hash256 mix_hash;
+};
+
+enum verification_result
+{
+    verify_ok = 0,
+    verify_invalid_final_hash = 1,
+    verify_invalid_mix_hash = 2,
+
+    // Not returned by verify(): reported by the verification service and the
+    // pipeline when the epoch context could not be created.
+    verify_no_context = -1,
+};
+
+struct epoch_context
+{
+    const int epoch_number;
+    const int light_cache_num_items;
+    const union hash512* const light_cache;
+    const uint32_t* const l1_cache;
+    const int full_dataset_num_items;
+};
+
+struct epoch_context_full : epoch_context
+{
+    hash1024* full_dataset;
+
+    constexpr epoch_context_full(int epoch, int light_num_items,
+        const hash512* light, const uint32_t* l1, int dataset_num_items,
+        hash1024* dataset) noexcept
+      : epoch_context{epoch, light_num_items, light, l1, dataset_num_items},
+        full_dataset{dataset}
+    {}
+};
+
+struct le
+{
+    static uint32_t uint32(uint32_t x) noexcept { return x; }
+    static uint64_t uint64(uint64_t x) noexcept { return x; }
+
+    static const hash1024& uint32s(const hash1024& h) noexcept { return h; }
+    static const hash512& uint32s(const hash512& h) noexcept { return h; }
+    static const hash256& uint32s(const hash256& h) noexcept { return h; }
+};
+
+struct be
+{
+    static uint64_t uint64(uint64_t x) noexcept { return __builtin_bswap64(x); }
+};
+
+inline constexpr size_t get_light_cache_size(int num_items) noexcept
+{
+    return static_cast<size_t>(num_items) * ETHASH_LIGHT_CACHE_ITEM_SIZE; //light_cache_item_size;
+}
+
+inline constexpr uint64_t get_full_dataset_size(int num_items) noexcept
+{
+    return static_cast<uint64_t>(num_items) * ETHASH_FULL_DATASET_ITEM_SIZE;
+}
+
+/** Compares two hashes as 256-bit big-endian numbers. */
+inline bool is_less_or_equal(const hash256& a, const hash256& b) noexcept
+{
+    for (size_t i = 0; i < sizeof(a) / sizeof(a.word64s[0]); ++i)
+    {
+        if (be::uint64(a.word64s[i]) > be::uint64(b.word64s[i]))
+            return false;
+        if (be::uint64(a.word64s[i]) < be::uint64(b.word64s[i]))
+            return true;
+    }
+    return true;
+}
+
+inline bool is_equal(const hash256& a, const hash256& b) noexcept
+{
+    return memcmp(a.bytes, b.bytes, sizeof(a)) == 0;
+}
+
+/** Keccak-f[1600] iota constants, shared with the multi-buffer permutation. */
+extern const uint64_t keccak_round_constants[24];
+
+void ethash_keccakf1600(uint64_t state[25]);
+void keccak(uint64_t* out, size_t bits, const uint8_t* data, size_t size);
+union hash256 ethash_keccak256(const uint8_t* data, size_t size);
+union hash256 ethash_keccak256_32(const uint8_t data[32]);
+union hash512 ethash_keccak512(const uint8_t* data, size_t size);
+union hash512 ethash_keccak512_64(const uint8_t data[64]);
+
+int find_largest_prime(int upper_bound);
+int find_epoch_number(const hash256& seed) noexcept;
+hash256 calculate_epoch_seed(int epoch_number) noexcept;
+int calculate_light_cache_num_items(int epoch_number) noexcept;
+int calculate_full_dataset_num_items(int epoch_number) noexcept;
+
+hash1024 calculate_dataset_item_1024(const epoch_context& context, uint32_t index) noexcept;
+hash2048 calculate_dataset_item_2048(const epoch_context& context, uint32_t index) noexcept;
+
+result hash(const epoch_context& context, const hash256& header_hash, uint64_t nonce) noexcept;
+verification_result verify(const epoch_context& context, const hash256& header_hash,
+    const hash256& mix_hash, uint64_t nonce, const hash256& boundary) noexcept;
+
+void build_light_cache(hash512 cache[], int num_items, const hash256& seed) noexcept;
+/**
+ * Last epoch whose sizes fit the int arithmetic of calculate_*_num_items():
+ * 2^23 + e * 2^16 dataset items stay below 2^31 for the ECIP-1099 epoch e.
+ */
+constexpr static int max_epoch_number =
+    2 * ((INT32_MAX - full_dataset_init_size / 128) / (full_dataset_growth / 128)) + 1;
+
+/** Returns nullptr for epochs outside [0, max_epoch_number] and when out of memory. */
+epoch_context_full* create_epoch_context(int epoch_number, bool full) noexcept;
+
+/** Same, with the seed of epoch_number already known (see calculate_epoch_seed()). */
+epoch_context_full* create_epoch_context(
+    int epoch_number, bool full, const hash256& epoch_seed) noexcept;
+void destroy_epoch_context(epoch_context_full* context) noexcept;
+
+using epoch_context_ptr = std::shared_ptr<const epoch_context_full>;
+
+/**
+ * Process-wide registry of epoch contexts.
+ *
+ * Every isolate (main thread and worker_threads) loading the addon shares
+ * the same contexts, so each epoch's light cache is built and held once.
+ * Concurrent requests for an epoch that is still being built wait for the
+ * first builder instead of building their own copy. Builds run on the
+ * shared thread pool at the priority of the request that started them.
+ */
+class epoch_context_registry
+{
+public:
+    epoch_context_ptr get(int epoch_number, task_priority priority = priority_current_epoch);
+
+    /** Drops the registry reference, the memory goes with the last user. */
+    void release(int epoch_number);
+
+private:
+    struct entry
+    {
+        std::shared_ptr<std::promise<epoch_context_ptr>> promise;  // Also tags the build task.
+        std::shared_future<epoch_context_ptr> future;
+    };
+
+    std::mutex mutex_;
+    std::map<int, entry> contexts_;
+};
+
+/** The registry shared by every user in the process. */
+epoch_context_registry& shared_epoch_contexts();
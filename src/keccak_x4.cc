@@ -0,0 +1,185 @@
+// Multi-buffer Keccak-256, AVX2 when the CPU has it.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include "keccak_x4.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LIBETH_KECCAK_AVX2 1
+#include <immintrin.h>
+#endif
+
+// Rotation of lane x + 5 * y.
+static const unsigned rotations[25] = {
+    0, 1, 62, 28, 27,
+    36, 44, 6, 55, 20,
+    3, 10, 43, 25, 39,
+    41, 45, 15, 21, 8,
+    18, 2, 61, 56, 14,
+};
+
+static uint64_t load_le(const uint8_t* data) noexcept
+{
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+size_t keccak256_pad(uint8_t* message, size_t size) noexcept
+{
+    const size_t num_blocks = size / keccak256_block_size + 1;
+    const size_t padded_size = num_blocks * keccak256_block_size;
+    memset(message + size, 0, padded_size - size);
+    message[size] ^= 0x01;
+    message[padded_size - 1] ^= 0x80;
+    return num_blocks;
+}
+
+static void keccak256_x4_generic(
+    const uint8_t* const messages[4], size_t num_blocks, hash256 out[4]) noexcept
+{
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        uint64_t state[25] = {0};
+        const uint8_t* data = messages[lane];
+        for (size_t b = 0; b < num_blocks; ++b)
+        {
+            for (size_t i = 0; i < keccak256_block_size / sizeof(uint64_t); ++i)
+                state[i] ^= load_le(data + i * sizeof(uint64_t));
+            ethash_keccakf1600(state);
+            data += keccak256_block_size;
+        }
+        memcpy(out[lane].bytes, state, sizeof(out[lane]));
+    }
+}
+
+#ifdef LIBETH_KECCAK_AVX2
+
+#if defined(__clang__)
+#define LIBETH_UNROLL _Pragma("unroll")
+#else
+#define LIBETH_UNROLL _Pragma("GCC unroll 5")
+#endif
+
+__attribute__((target("avx2"))) static inline __m256i rol_x4(__m256i x, unsigned s) noexcept
+{
+    // Shift counts of 64 give zero, so s == 0 needs no special case.
+    return _mm256_or_si256(_mm256_sll_epi64(x, _mm_cvtsi32_si128(static_cast<int>(s))),
+        _mm256_srl_epi64(x, _mm_cvtsi32_si128(static_cast<int>(64 - s))));
+}
+
+__attribute__((target("avx2"))) static void keccakf1600_x4(__m256i a[25]) noexcept
+{
+    __m256i b[25];
+    __m256i c[5];
+    __m256i d[5];
+
+    // The lane indexes and rotations must fold into constants, make sure the
+    // inner loops are unrolled at any optimization level above -O0.
+    for (int round = 0; round < 24; ++round)
+    {
+        // Theta.
+        LIBETH_UNROLL
+        for (int x = 0; x < 5; ++x)
+            c[x] = _mm256_xor_si256(_mm256_xor_si256(a[x], a[x + 5]),
+                _mm256_xor_si256(_mm256_xor_si256(a[x + 10], a[x + 15]), a[x + 20]));
+        LIBETH_UNROLL
+        for (int x = 0; x < 5; ++x)
+            d[x] = _mm256_xor_si256(c[(x + 4) % 5], rol_x4(c[(x + 1) % 5], 1));
+
+        // Rho and pi.
+        LIBETH_UNROLL
+        for (int y = 0; y < 5; ++y)
+        {
+            LIBETH_UNROLL
+            for (int x = 0; x < 5; ++x)
+            {
+                const int i = x + 5 * y;
+                b[y + 5 * ((2 * x + 3 * y) % 5)] =
+                    rol_x4(_mm256_xor_si256(a[i], d[x]), rotations[i]);
+            }
+        }
+
+        // Chi.
+        LIBETH_UNROLL
+        for (int y = 0; y < 25; y += 5)
+        {
+            LIBETH_UNROLL
+            for (int x = 0; x < 5; ++x)
+                a[y + x] = _mm256_xor_si256(
+                    b[y + x], _mm256_andnot_si256(b[y + (x + 1) % 5], b[y + (x + 2) % 5]));
+        }
+
+        // Iota.
+        a[0] = _mm256_xor_si256(
+            a[0], _mm256_set1_epi64x(static_cast<long long>(keccak_round_constants[round])));
+    }
+}
+
+__attribute__((target("avx2"))) static void keccak256_x4_avx2(
+    const uint8_t* const messages[4], size_t num_blocks, hash256 out[4]) noexcept
+{
+    __m256i state[25];
+    for (auto& lane : state)
+        lane = _mm256_setzero_si256();
+
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        const size_t offset = b * keccak256_block_size;
+        for (size_t i = 0; i < keccak256_block_size / sizeof(uint64_t); ++i)
+        {
+            const size_t at = offset + i * sizeof(uint64_t);
+            state[i] = _mm256_xor_si256(state[i],
+                _mm256_set_epi64x(static_cast<long long>(load_le(messages[3] + at)),
+                    static_cast<long long>(load_le(messages[2] + at)),
+                    static_cast<long long>(load_le(messages[1] + at)),
+                    static_cast<long long>(load_le(messages[0] + at))));
+        }
+        keccakf1600_x4(state);
+    }
+
+    for (size_t i = 0; i < sizeof(hash256) / sizeof(uint64_t); ++i)
+    {
+        alignas(32) uint64_t words[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words), state[i]);
+        for (int lane = 0; lane < 4; ++lane)
+            out[lane].word64s[i] = words[lane];
+    }
+}
+
+#endif
+
+bool keccak256_x4_accelerated() noexcept
+{
+#ifdef LIBETH_KECCAK_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+void keccak256_x4(const uint8_t* const messages[4], size_t num_blocks, hash256 out[4]) noexcept
+{
+#ifdef LIBETH_KECCAK_AVX2
+    if (keccak256_x4_accelerated())
+        return keccak256_x4_avx2(messages, num_blocks, out);
+#endif
+    keccak256_x4_generic(messages, num_blocks, out);
+}
@@ -0,0 +1,47 @@
+/**
+ * Multi-buffer Keccak-256: four independent messages hashed at once, one
+ * per 64-bit lane of a 256-bit vector. Used where whole batches of short
+ * messages are hashed, like header seal hashes.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+
+#include "ethash.h"
+
+/** Keccak-256 rate in bytes. */
+constexpr static size_t keccak256_block_size = (1600 - 2 * 256) / 8;
+
+/**
+ * Appends Keccak padding after size bytes of message in place and returns
+ * the number of blocks. The buffer must have room up to the end of the last
+ * block.
+ */
+size_t keccak256_pad(uint8_t* message, size_t size) noexcept;
+
+/** True when the CPU runs keccak256_x4() in SIMD. */
+bool keccak256_x4_accelerated() noexcept;
+
+/**
+ * Hashes four messages already padded with keccak256_pad() to the same
+ * number of blocks. Falls back to four sequential permutations without
+ * AVX2.
+ */
+void keccak256_x4(const uint8_t* const messages[4], size_t num_blocks, hash256 out[4]) noexcept;
@@ -0,0 +1,207 @@
+/**
+ * Minimal data-parallel helpers for the native tools and the addon.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "thread_pool.h"
+
+inline unsigned default_num_threads() noexcept
+{
+    const unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+/** Shared by a parallel_for() caller and its helper tasks. */
+template <class Fn>
+struct parallel_for_state
+{
+    parallel_for_state(uint64_t begin, uint64_t end, uint64_t grain, task_priority priority, Fn& fn)
+      : next{begin}, end{end}, grain{grain}, priority{priority}, fn{fn}
+    {}
+
+    std::atomic<uint64_t> next;
+    const uint64_t end;
+    const uint64_t grain;
+    const task_priority priority;
+    Fn& fn;  // Only touched while counted in active.
+
+    std::atomic<unsigned> active{0};
+    std::atomic<bool> closed{false};  // Set by the caller once the range is done.
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    /** Runs the next chunk of indexes, false once there are none left. */
+    bool run_chunk()
+    {
+        const uint64_t first = next.fetch_add(grain);
+        if (first >= end)
+            return false;
+        const uint64_t last = std::min(end, first + grain);
+        for (uint64_t i = first; i < last; ++i)
+            fn(i);
+        return true;
+    }
+
+    /**
+     * Body of a helper task. Hands the worker over to more urgent tasks by
+     * queueing itself again; helpers starting after the caller returned
+     * only touch the state.
+     */
+    static void help(const std::shared_ptr<parallel_for_state>& s)
+    {
+        ++s->active;
+        if (!s->closed)
+        {
+            thread_pool& pool = shared_thread_pool();
+            while (s->run_chunk())
+            {
+                if (pool.has_queued_above(s->priority))
+                {
+                    pool.submit([s] { help(s); }, s->priority);
+                    break;
+                }
+            }
+        }
+        if (--s->active == 0)
+        {
+            std::lock_guard<std::mutex> lock{s->mutex};
+            s->cv.notify_all();
+        }
+    }
+};
+
+/**
+ * Calls fn(i) for every i in [begin, end) on the shared pool, at most
+ * num_threads threads (0: the whole pool) including the calling thread.
+ * Indexes are handed out in chunks of `grain` so threads finishing early
+ * pick up the remaining work. Returns once every call has returned.
+ *
+ * The caller keeps its thread until then, pool tasks with long ranges use
+ * parallel_for_async() instead.
+ */
+template <class Fn>
+void parallel_for(task_priority priority, uint64_t begin, uint64_t end, unsigned num_threads,
+    uint64_t grain, Fn fn)
+{
+    if (begin >= end)
+        return;
+
+    thread_pool& pool = shared_thread_pool();
+    const bool on_worker = pool.on_worker_thread();
+    const uint64_t num_chunks = (end - begin + grain - 1) / grain;
+    uint64_t num_helpers = std::min<uint64_t>(pool.size() - (on_worker ? 1 : 0), num_chunks - 1);
+    if (num_threads)
+        num_helpers = std::min<uint64_t>(num_helpers, num_threads - 1);
+
+    auto s = std::make_shared<parallel_for_state<Fn>>(begin, end, grain, priority, fn);
+    for (uint64_t i = 0; i < num_helpers; ++i)
+        pool.submit([s] { parallel_for_state<Fn>::help(s); }, priority);
+
+    // The caller works too. On a worker it does not run unrelated tasks
+    // inline, the helpers give way to more urgent work instead.
+    while (s->run_chunk())
+    {
+    }
+
+    s->closed = true;
+    std::unique_lock<std::mutex> lock{s->mutex};
+    s->cv.wait(lock, [&] { return s->active == 0; });
+}
+
+/** State of a parallel_for_async(), owned by its queued and running tasks. */
+template <class Fn, class Done>
+struct parallel_for_async_state
+{
+    parallel_for_async_state(uint64_t begin, uint64_t end, uint64_t grain, task_priority priority,
+        Fn&& fn, Done&& done)
+      : next{begin},
+        end{end},
+        grain{grain},
+        priority{priority},
+        chunks_left{(end - begin + grain - 1) / grain},
+        fn{std::move(fn)},
+        done{std::move(done)}
+    {}
+
+    std::atomic<uint64_t> next;
+    const uint64_t end;
+    const uint64_t grain;
+    const task_priority priority;
+    std::atomic<uint64_t> chunks_left;
+    Fn fn;
+    Done done;
+
+    /**
+     * Body of every task. Stops after a chunk when more urgent work is
+     * queued and queues itself again, so no task holds its worker for more
+     * than a chunk. The task finishing the last chunk calls done.
+     */
+    static void run(const std::shared_ptr<parallel_for_async_state>& s)
+    {
+        thread_pool& pool = shared_thread_pool();
+        for (;;)
+        {
+            const uint64_t first = s->next.fetch_add(s->grain);
+            if (first >= s->end)
+                return;
+            const uint64_t last = std::min(s->end, first + s->grain);
+            for (uint64_t i = first; i < last; ++i)
+                s->fn(i);
+
+            if (--s->chunks_left == 0)
+                return s->done();
+            if (pool.has_queued_above(s->priority))
+                return pool.submit([s] { run(s); }, s->priority);
+        }
+    }
+};
+
+/**
+ * parallel_for() that returns at once: fn(i) runs in up to num_threads pool
+ * tasks (0: one per worker) and done() is called on the pool thread that
+ * finishes the last index, or inline when the range is empty. Neither the
+ * caller nor any worker waits for the range, the tasks requeue between
+ * chunks when more urgent work comes in.
+ */
+template <class Fn, class Done>
+void parallel_for_async(task_priority priority, uint64_t begin, uint64_t end, unsigned num_threads,
+    uint64_t grain, Fn fn, Done done)
+{
+    if (begin >= end)
+        return done();
+
+    thread_pool& pool = shared_thread_pool();
+    const uint64_t num_chunks = (end - begin + grain - 1) / grain;
+    uint64_t num_tasks = std::min<uint64_t>(pool.size(), num_chunks);
+    if (num_threads)
+        num_tasks = std::min<uint64_t>(num_tasks, num_threads);
+
+    using state = parallel_for_async_state<Fn, Done>;
+    auto s = std::make_shared<state>(begin, end, grain, priority, std::move(fn), std::move(done));
+    for (uint64_t i = 0; i < num_tasks; ++i)
+        pool.submit([s] { state::run(s); }, priority);
+}
@@ -0,0 +1,193 @@
+// Batch header seal hashes: RLP encoding and multi-buffer keccak256.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include "seal_hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "keccak_x4.h"
+
+// Headers encoded into the arena per round.
+constexpr static size_t arena_batch_size = 64;
+
+// The list prefix of the largest encoding takes 3 bytes, so the payload
+// always starts at that offset and the prefix is written right before it.
+constexpr static size_t list_prefix_room = 3;
+
+constexpr static size_t max_padded_size =
+    (seal_header_max_rlp_size / keccak256_block_size + 1) * keccak256_block_size;
+
+constexpr static size_t arena_stride = (list_prefix_room + max_padded_size + 63) & ~size_t{63};
+
+constexpr static size_t max_blocks = max_padded_size / keccak256_block_size;
+
+static uint8_t* rlp_string(uint8_t* out, const uint8_t* data, size_t size) noexcept
+{
+    if (size == 1 && data[0] < 0x80)
+    {
+        *out++ = data[0];
+        return out;
+    }
+    if (size <= 55)
+        *out++ = static_cast<uint8_t>(0x80 + size);
+    else
+    {
+        // Only the 256-byte bloom is longer, 2 length bytes are plenty.
+        *out++ = 0xb9;
+        *out++ = static_cast<uint8_t>(size >> 8);
+        *out++ = static_cast<uint8_t>(size);
+    }
+    memcpy(out, data, size);
+    return out + size;
+}
+
+/** Encodes a big-endian integer, i.e. without its leading zeros. */
+static uint8_t* rlp_uint(uint8_t* out, const uint8_t* data, size_t size) noexcept
+{
+    while (size > 0 && data[0] == 0)
+    {
+        ++data;
+        --size;
+    }
+    return rlp_string(out, data, size);
+}
+
+/** Writes the list prefix right before payload and returns where it starts. */
+static uint8_t* rlp_list_prefix(uint8_t* payload, size_t payload_size) noexcept
+{
+    if (payload_size <= 55)
+    {
+        *--payload = static_cast<uint8_t>(0xc0 + payload_size);
+        return payload;
+    }
+    if (payload_size <= 0xff)
+    {
+        *--payload = static_cast<uint8_t>(payload_size);
+        *--payload = 0xf8;
+        return payload;
+    }
+    *--payload = static_cast<uint8_t>(payload_size);
+    *--payload = static_cast<uint8_t>(payload_size >> 8);
+    *--payload = 0xf9;
+    return payload;
+}
+
+/** Encodes into out + list_prefix_room, returns the encoding start or nullptr. */
+static uint8_t* encode(const seal_header_record& r, uint8_t* out, size_t& size) noexcept
+{
+    if (r.extra_data_size > sizeof(r.extra_data))
+        return nullptr;
+
+    uint8_t* const payload = out + list_prefix_room;
+    uint8_t* p = payload;
+    p = rlp_string(p, r.parent_hash, sizeof(r.parent_hash));
+    p = rlp_string(p, r.ommers_hash, sizeof(r.ommers_hash));
+    p = rlp_string(p, r.beneficiary, sizeof(r.beneficiary));
+    p = rlp_string(p, r.state_root, sizeof(r.state_root));
+    p = rlp_string(p, r.transactions_root, sizeof(r.transactions_root));
+    p = rlp_string(p, r.receipts_root, sizeof(r.receipts_root));
+    p = rlp_string(p, r.logs_bloom, sizeof(r.logs_bloom));
+    p = rlp_uint(p, r.difficulty, sizeof(r.difficulty));
+    p = rlp_uint(p, r.number, sizeof(r.number));
+    p = rlp_uint(p, r.gas_limit, sizeof(r.gas_limit));
+    p = rlp_uint(p, r.gas_used, sizeof(r.gas_used));
+    p = rlp_uint(p, r.timestamp, sizeof(r.timestamp));
+    p = rlp_string(p, r.extra_data, r.extra_data_size);
+    if (r.flags & seal_header_has_base_fee)
+        p = rlp_uint(p, r.base_fee, sizeof(r.base_fee));
+
+    const size_t payload_size = static_cast<size_t>(p - payload);
+    uint8_t* const begin = rlp_list_prefix(payload, payload_size);
+    size = static_cast<size_t>(p - begin);
+    return begin;
+}
+
+size_t rlp_encode_seal_header(const seal_header_record& record, uint8_t* out) noexcept
+{
+    uint8_t buf[list_prefix_room + seal_header_max_rlp_size];
+    size_t size = 0;
+    const uint8_t* const begin = encode(record, buf, size);
+    if (!begin)
+        return 0;
+    memcpy(out, begin, size);
+    return size;
+}
+
+size_t seal_hashes(const seal_header_record* records, size_t count, hash256* out)
+{
+    static thread_local std::vector<uint8_t> arena;
+    arena.resize(arena_batch_size * arena_stride);
+
+    const bool multi_buffer = keccak256_x4_accelerated();
+    size_t first_invalid = count;
+
+    for (size_t base = 0; base < count; base += arena_batch_size)
+    {
+        const size_t n = std::min(arena_batch_size, count - base);
+
+        const uint8_t* messages[arena_batch_size];
+        size_t sizes[arena_batch_size];
+
+        // Bucket the encodings by block count, lanes of a keccak256_x4() call
+        // must absorb the same number of blocks.
+        size_t buckets[max_blocks + 1][arena_batch_size];
+        size_t bucket_sizes[max_blocks + 1] = {};
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint8_t* const slot = &arena[i * arena_stride];
+            uint8_t* const begin = encode(records[base + i], slot, sizes[i]);
+            if (!begin)
+            {
+                out[base + i] = {};
+                if (first_invalid == count)
+                    first_invalid = base + i;
+                continue;
+            }
+            messages[i] = begin;
+            if (multi_buffer)
+            {
+                const size_t num_blocks = keccak256_pad(begin, sizes[i]);
+                buckets[num_blocks][bucket_sizes[num_blocks]++] = i;
+            }
+            else
+                out[base + i] = ethash_keccak256(begin, sizes[i]);
+        }
+
+        for (size_t num_blocks = 1; num_blocks <= max_blocks; ++num_blocks)
+        {
+            const size_t* const bucket = buckets[num_blocks];
+            const size_t bucket_size = bucket_sizes[num_blocks];
+            size_t j = 0;
+            for (; j + 4 <= bucket_size; j += 4)
+            {
+                const uint8_t* const lanes[4] = {messages[bucket[j]], messages[bucket[j + 1]],
+                    messages[bucket[j + 2]], messages[bucket[j + 3]]};
+                hash256 hashes[4];
+                keccak256_x4(lanes, num_blocks, hashes);
+                for (size_t k = 0; k < 4; ++k)
+                    out[base + bucket[j + k]] = hashes[k];
+            }
+            for (; j < bucket_size; ++j)
+                out[base + bucket[j]] = ethash_keccak256(messages[bucket[j]], sizes[bucket[j]]);
+        }
+    }
+    return first_invalid;
+}
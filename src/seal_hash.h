@@ -0,0 +1,72 @@
+/**
+ * Header seal hashes: keccak256 of the RLP-encoded header without the mix
+ * hash and nonce, the hash Ethash is computed over.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+
+#include "ethash.h"
+
+constexpr static uint8_t seal_header_has_base_fee = 0x01;
+
+/** Fixed-size header fields, integers big-endian and zero-padded on the left. */
+struct seal_header_record
+{
+    uint8_t parent_hash[32];
+    uint8_t ommers_hash[32];
+    uint8_t beneficiary[20];
+    uint8_t state_root[32];
+    uint8_t transactions_root[32];
+    uint8_t receipts_root[32];
+    uint8_t logs_bloom[256];
+    uint8_t difficulty[32];
+    uint8_t number[8];
+    uint8_t gas_limit[8];
+    uint8_t gas_used[8];
+    uint8_t timestamp[8];
+    uint8_t extra_data_size;  // At most 32.
+    uint8_t flags;  // seal_header_has_base_fee for London headers.
+    uint8_t reserved[2];
+    uint8_t extra_data[32];
+    uint8_t base_fee[32];
+};
+
+static_assert(sizeof(seal_header_record) == 568, "seal_header_record must stay packed");
+
+/** Largest RLP encoding of a seal_header_record. */
+constexpr static size_t seal_header_max_rlp_size = 583;
+
+/**
+ * RLP-encodes the header fields into out, which must have room for
+ * seal_header_max_rlp_size bytes, and returns the size; 0 if the record is
+ * invalid.
+ */
+size_t rlp_encode_seal_header(const seal_header_record& record, uint8_t* out) noexcept;
+
+/**
+ * Computes the seal hashes of count records. Encodings go to a per-thread
+ * scratch arena that is reused across calls, and are hashed four at a time
+ * with the multi-buffer Keccak where the CPU supports it.
+ *
+ * Returns the index of the first invalid record (its hash is left zero), or
+ * count when every record is valid.
+ */
+size_t seal_hashes(const seal_header_record* records, size_t count, hash256* out);
@@ -0,0 +1,190 @@
+// 256-bit difficulty boundaries and multi-target share grading.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include "share_grading.h"
+
+#include <algorithm>
+
+namespace
+{
+/** Little-endian 64-bit limbs, w[0] least significant. */
+struct uint256
+{
+    uint64_t w[4];
+};
+
+uint256 from_be(const hash256& h) noexcept
+{
+    return {{be::uint64(h.word64s[3]), be::uint64(h.word64s[2]), be::uint64(h.word64s[1]),
+        be::uint64(h.word64s[0])}};
+}
+
+hash256 to_be(const uint256& x) noexcept
+{
+    hash256 h;
+    for (int i = 0; i < 4; ++i)
+        h.word64s[i] = be::uint64(x.w[3 - i]);
+    return h;
+}
+
+bool less_or_equal(const uint256& a, const uint256& b) noexcept
+{
+    for (int i = 3; i >= 0; --i)
+    {
+        if (a.w[i] != b.w[i])
+            return a.w[i] < b.w[i];
+    }
+    return true;
+}
+
+void subtract(uint256& a, const uint256& b) noexcept
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        const uint64_t d = a.w[i] - b.w[i] - borrow;
+        borrow = (a.w[i] < b.w[i]) || (a.w[i] - b.w[i] < borrow);
+        a.w[i] = d;
+    }
+}
+
+/** Shifts left by one and returns the bit shifted out. */
+uint64_t shift_left(uint256& a) noexcept
+{
+    const uint64_t carry = a.w[3] >> 63;
+    for (int i = 3; i > 0; --i)
+        a.w[i] = (a.w[i] << 1) | (a.w[i - 1] >> 63);
+    a.w[0] <<= 1;
+    return carry;
+}
+
+bool is_zero_or_one(const uint256& a) noexcept
+{
+    return a.w[3] == 0 && a.w[2] == 0 && a.w[1] == 0 && a.w[0] <= 1;
+}
+}  // namespace
+
+hash256 difficulty_to_boundary(const hash256& difficulty) noexcept
+{
+    const uint256 d = from_be(difficulty);
+    if (is_zero_or_one(d))
+    {
+        hash256 max;
+        memset(max.bytes, 0xff, sizeof(max));
+        return max;
+    }
+
+    // Long division of 2^256 - 1 by d, one bit at a time. The remainder
+    // stays below d, but may carry one bit past 256 while shifting.
+    uint256 q = {};
+    uint256 r = {};
+    for (int bit = 255; bit >= 0; --bit)
+    {
+        const uint64_t carry = shift_left(r);
+        r.w[0] |= 1;
+        shift_left(q);
+        if (carry || less_or_equal(d, r))
+        {
+            subtract(r, d);
+            q.w[0] |= 1;
+        }
+    }
+
+    // 2^256 / d is one more than (2^256 - 1) / d when d divides 2^256.
+    uint256 r1 = r;
+    uint64_t c = 1;
+    for (int i = 0; i < 4 && c; ++i)
+        c = ++r1.w[i] == 0;
+    if (!c && less_or_equal(d, r1))
+    {
+        for (int i = 0; i < 4 && ++q.w[i] == 0; ++i)
+        {
+        }
+    }
+    return to_be(q);
+}
+
+hash256 difficulty_to_boundary(uint64_t difficulty) noexcept
+{
+    hash256 d = {};
+    d.word64s[3] = be::uint64(difficulty);
+    return difficulty_to_boundary(d);
+}
+
+hash256 boundary_cache::get(const hash256& difficulty)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto it = boundaries_.find(difficulty);
+        if (it != boundaries_.end())
+            return it->second;
+    }
+
+    const hash256 boundary = difficulty_to_boundary(difficulty);
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (boundaries_.size() >= max_entries)
+        boundaries_.clear();
+    boundaries_.emplace(difficulty, boundary);
+    return boundary;
+}
+
+boundary_cache& shared_boundary_cache()
+{
+    static boundary_cache* cache = new boundary_cache;
+    return *cache;
+}
+
+share_grader::share_grader(const hash256* boundaries, size_t count)
+{
+    count = std::min(count, max_share_targets);
+    targets_.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (int w = 0; w < 4; ++w)
+            targets_[i].words[w] = be::uint64(boundaries[i].word64s[w]);
+        targets_[i].tier = static_cast<uint8_t>(i + 1);
+    }
+
+    std::stable_sort(targets_.begin(), targets_.end(), [](const target& a, const target& b) {
+        return std::lexicographical_compare(b.words, b.words + 4, a.words, a.words + 4);
+    });
+}
+
+uint8_t share_grader::grade(const hash256& final_hash) const noexcept
+{
+    const uint64_t h[4] = {be::uint64(final_hash.word64s[0]), be::uint64(final_hash.word64s[1]),
+        be::uint64(final_hash.word64s[2]), be::uint64(final_hash.word64s[3])};
+
+    // Meeting a boundary implies meeting every easier one: walk from the
+    // easiest and stop at the first one missed.
+    uint8_t tier = 0;
+    for (const target& t : targets_)
+    {
+        if (std::lexicographical_compare(t.words, t.words + 4, h, h + 4))
+            break;  // boundary < hash
+        tier = t.tier;
+    }
+    return tier;
+}
+
+void share_grader::grade(const hash256* final_hashes, size_t count, uint8_t* tiers) const noexcept
+{
+    for (size_t i = 0; i < count; ++i)
+        tiers[i] = grade(final_hashes[i]);
+}
@@ -0,0 +1,95 @@
+/**
+ * Share grading against several difficulty targets at once, e.g. the pool
+ * minimum, the miner's vardiff difficulty and the network block target.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "ethash.h"
+
+/** Most targets a share_grader takes, tiers fit a byte. */
+constexpr static size_t max_share_targets = 255;
+
+/**
+ * Boundary of a 256-bit big-endian difficulty: floor(2^256 / difficulty),
+ * saturated to 2^256 - 1 for difficulties 0 and 1.
+ */
+hash256 difficulty_to_boundary(const hash256& difficulty) noexcept;
+
+hash256 difficulty_to_boundary(uint64_t difficulty) noexcept;
+
+/**
+ * Memoizes difficulty_to_boundary(). Pools see the same few difficulties
+ * over and over, so the division runs once per difficulty.
+ */
+class boundary_cache
+{
+public:
+    hash256 get(const hash256& difficulty);
+
+private:
+    struct less
+    {
+        bool operator()(const hash256& a, const hash256& b) const noexcept
+        {
+            return memcmp(a.bytes, b.bytes, sizeof(a)) < 0;
+        }
+    };
+
+    static constexpr size_t max_entries = 4096;
+
+    std::mutex mutex_;
+    std::map<hash256, hash256, less> boundaries_;
+};
+
+/** The cache shared by every user in the process. */
+boundary_cache& shared_boundary_cache();
+
+/**
+ * Grades final hashes against a fixed set of boundaries in one pass.
+ *
+ * The tier of a hash is 1 + the index (in construction order) of the
+ * hardest boundary it meets, or 0 if it meets none. Among equal boundaries
+ * the last one wins.
+ */
+class share_grader
+{
+public:
+    /** Takes at most max_share_targets big-endian boundaries. */
+    share_grader(const hash256* boundaries, size_t count);
+
+    uint8_t grade(const hash256& final_hash) const noexcept;
+
+    void grade(const hash256* final_hashes, size_t count, uint8_t* tiers) const noexcept;
+
+private:
+    struct target
+    {
+        uint64_t words[4];  // Most significant first, native endianness.
+        uint8_t tier;
+    };
+
+    std::vector<target> targets_;  // Easiest (largest boundary) first.
+};
@@ -0,0 +1,158 @@
+/**
+ * Lock-free ring buffer laid out in caller-provided (shared) memory.
+ *
+ * The ring only holds trivially copyable values and keeps its control
+ * words in std::atomic<uint64_t>, which is lock-free and address-free, so a
+ * ring placed in a POSIX shared memory mapping works across processes.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+    "shared memory rings need lock-free 64-bit atomics");
+
+constexpr size_t cache_line_size = 64;
+
+inline bool is_power_of_two(uint64_t x) noexcept
+{
+    return x && !(x & (x - 1));
+}
+
+/**
+ * Bounded multi-producer multi-consumer ring (D. Vyukov's algorithm).
+ *
+ * Every cell carries a sequence number telling producers and consumers
+ * whether it is free for the lap they are on, so neither side takes a lock.
+ * The capacity must be a power of two.
+ *
+ * Lock-free only among live threads: a process that dies between claiming
+ * a cell and publishing it leaves that cell, and so the ring, stuck. Rings
+ * shared with processes that may crash need an owner that can tell when
+ * nobody else is inside and init() them again, like the per-client queues
+ * of the verification service.
+ */
+template <class T>
+class mpmc_ring
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ring values are copied bytewise");
+
+public:
+    struct cell
+    {
+        std::atomic<uint64_t> sequence;
+        T value;
+    };
+
+    struct control
+    {
+        alignas(cache_line_size) std::atomic<uint64_t> enqueue_pos;
+        alignas(cache_line_size) std::atomic<uint64_t> dequeue_pos;
+    };
+
+    static constexpr size_t storage_size(uint64_t capacity) noexcept
+    {
+        return sizeof(control) + capacity * sizeof(cell);
+    }
+
+    mpmc_ring() noexcept = default;
+
+    /** Attaches to storage_size(capacity) bytes at storage. */
+    mpmc_ring(void* storage, uint64_t capacity) noexcept
+      : control_{static_cast<control*>(storage)},
+        cells_{reinterpret_cast<cell*>(static_cast<char*>(storage) + sizeof(control))},
+        mask_{capacity - 1}
+    {}
+
+    /** Initializes the ring, done once by the creator before anybody attaches. */
+    void init() noexcept
+    {
+        new (&control_->enqueue_pos) std::atomic<uint64_t>{0};
+        new (&control_->dequeue_pos) std::atomic<uint64_t>{0};
+        for (uint64_t i = 0; i <= mask_; ++i)
+            new (&cells_[i].sequence) std::atomic<uint64_t>{i};
+    }
+
+    bool try_push(const T& value) noexcept
+    {
+        uint64_t pos = control_->enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell& c = cells_[pos & mask_];
+            const uint64_t seq = c.sequence.load(std::memory_order_acquire);
+            const int64_t diff = static_cast<int64_t>(seq - pos);
+            if (diff == 0)
+            {
+                if (control_->enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                {
+                    c.value = value;
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;  // Full.
+            else
+                pos = control_->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool try_pop(T& value) noexcept
+    {
+        uint64_t pos = control_->dequeue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell& c = cells_[pos & mask_];
+            const uint64_t seq = c.sequence.load(std::memory_order_acquire);
+            const int64_t diff = static_cast<int64_t>(seq - (pos + 1));
+            if (diff == 0)
+            {
+                if (control_->dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                {
+                    value = c.value;
+                    c.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;  // Empty.
+            else
+                pos = control_->dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    /** Safe from any thread, the answer may be stale by the time it is used. */
+    bool empty() const noexcept
+    {
+        const uint64_t pos = control_->dequeue_pos.load(std::memory_order_relaxed);
+        const uint64_t seq = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+        return static_cast<int64_t>(seq - (pos + 1)) < 0;
+    }
+
+private:
+    control* control_ = nullptr;
+    cell* cells_ = nullptr;
+    uint64_t mask_ = 0;
+};
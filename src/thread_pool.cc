@@ -0,0 +1,266 @@
+// Process-wide pool of worker threads with priority classes.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include "thread_pool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+
+#include "parallel.h"
+
+struct worker_identity
+{
+    const thread_pool* pool;
+    unsigned index;
+};
+
+static thread_local worker_identity current_worker = {nullptr, 0};
+
+thread_pool::thread_pool(const thread_pool_options& options)
+{
+    const unsigned num_threads = options.num_threads ? options.num_threads : default_num_threads();
+    for (unsigned i = 0; i < num_threads; ++i)
+        queues_.emplace_back(new worker_queue);
+    for (unsigned i = 0; i < num_threads; ++i)
+    {
+        const int cpu = options.cpus.empty() ? -1 : options.cpus[i % options.cpus.size()];
+        threads_.emplace_back(&thread_pool::run, this, i, cpu);
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock{sleep_mutex_};
+        stop_ = true;
+    }
+    sleep_cv_.notify_all();
+    for (auto& t : threads_)
+        t.join();
+}
+
+void thread_pool::submit(std::function<void()> fn, task_priority priority, const void* group)
+{
+    // Workers queue to themselves, others spread their tasks around.
+    const unsigned index = current_worker.pool == this ?
+                               current_worker.index :
+                               next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    worker_queue& q = *queues_[index];
+    {
+        std::lock_guard<std::mutex> lock{q.mutex};
+        q.tasks[priority].push_back({std::move(fn), std::chrono::steady_clock::now(), group});
+        ++submitted_[priority];  // Before queued_, stats() reads them the other way round.
+        ++queued_[priority];
+        ++total_queued_;
+    }
+
+    // Pairs with the predicate check of a worker going to sleep.
+    {
+        std::lock_guard<std::mutex> lock{sleep_mutex_};
+    }
+    sleep_cv_.notify_one();
+}
+
+bool thread_pool::on_worker_thread() const noexcept
+{
+    return current_worker.pool == this;
+}
+
+bool thread_pool::has_queued_above(task_priority priority) const noexcept
+{
+    for (int p = 0; p < priority; ++p)
+    {
+        if (queued_[p].load(std::memory_order_relaxed) != 0)
+            return true;
+    }
+    return false;
+}
+
+bool thread_pool::run_one(const void* group)
+{
+    if (current_worker.pool != this || !group)
+        return false;
+
+    task t;
+    int priority;
+    if (!take_group(current_worker.index, group, t, priority))
+        return false;
+    execute(t, priority);
+    return true;
+}
+
+thread_pool_stats thread_pool::stats() const noexcept
+{
+    thread_pool_stats s;
+    s.num_threads = size();
+    s.steals = steals_;
+    for (int p = 0; p < num_task_priorities; ++p)
+    {
+        s.classes[p].queued = queued_[p];
+        s.classes[p].submitted = submitted_[p];
+        s.classes[p].completed = completed_[p];
+        s.classes[p].total_wait_ns = total_wait_ns_[p];
+        s.classes[p].max_wait_ns = max_wait_ns_[p];
+    }
+    return s;
+}
+
+void thread_pool::run(unsigned index, int cpu)
+{
+#ifdef __linux__
+    if (cpu >= 0)
+    {
+        // Best effort: a CPU outside the process's set leaves the worker unpinned.
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)cpu;
+#endif
+    current_worker = {this, index};
+
+    for (;;)
+    {
+        task t;
+        int priority;
+        if (take(index, t, priority))
+        {
+            execute(t, priority);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock{sleep_mutex_};
+        sleep_cv_.wait(lock, [this] { return stop_ || total_queued_ != 0; });
+        if (stop_ && total_queued_ == 0)
+            return;
+    }
+}
+
+bool thread_pool::take(unsigned index, task& out, int& priority)
+{
+    const unsigned n = static_cast<unsigned>(queues_.size());
+    for (int p = 0; p < num_task_priorities; ++p)
+    {
+        if (queued_[p].load(std::memory_order_acquire) == 0)
+            continue;
+
+        // Own queue first, then steal.
+        for (unsigned k = 0; k < n; ++k)
+        {
+            worker_queue& q = *queues_[(index + k) % n];
+            std::lock_guard<std::mutex> lock{q.mutex};
+            std::deque<task>& tasks = q.tasks[p];
+            if (tasks.empty())
+                continue;
+
+            out = std::move(tasks.front());
+            tasks.pop_front();
+            --queued_[p];
+            --total_queued_;
+            if (k != 0)
+                steals_.fetch_add(1, std::memory_order_relaxed);
+            priority = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool thread_pool::take_group(unsigned index, const void* group, task& out, int& priority)
+{
+    const unsigned n = static_cast<unsigned>(queues_.size());
+    for (int p = 0; p < num_task_priorities; ++p)
+    {
+        if (queued_[p].load(std::memory_order_acquire) == 0)
+            continue;
+
+        for (unsigned k = 0; k < n; ++k)
+        {
+            worker_queue& q = *queues_[(index + k) % n];
+            std::lock_guard<std::mutex> lock{q.mutex};
+            std::deque<task>& tasks = q.tasks[p];
+            const auto it = std::find_if(
+                tasks.begin(), tasks.end(), [group](const task& t) { return t.group == group; });
+            if (it == tasks.end())
+                continue;
+
+            out = std::move(*it);
+            tasks.erase(it);
+            --queued_[p];
+            --total_queued_;
+            if (k != 0)
+                steals_.fetch_add(1, std::memory_order_relaxed);
+            priority = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::execute(task& t, int priority)
+{
+    const uint64_t wait_ns = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - t.queued_at)
+            .count());
+    total_wait_ns_[priority].fetch_add(wait_ns, std::memory_order_relaxed);
+    uint64_t max = max_wait_ns_[priority].load(std::memory_order_relaxed);
+    while (wait_ns > max && !max_wait_ns_[priority].compare_exchange_weak(max, wait_ns))
+    {
+    }
+
+    t.fn();
+    ++completed_[priority];
+}
+
+static std::mutex shared_pool_mutex;
+static thread_pool_options shared_pool_options;
+static std::atomic<thread_pool*> shared_pool{nullptr};
+
+bool configure_shared_thread_pool(const thread_pool_options& options)
+{
+    std::lock_guard<std::mutex> lock{shared_pool_mutex};
+    if (shared_pool.load(std::memory_order_relaxed))
+        return false;
+    shared_pool_options = options;
+    return true;
+}
+
+thread_pool& shared_thread_pool()
+{
+    thread_pool* pool = shared_pool.load(std::memory_order_acquire);
+    if (pool)
+        return *pool;
+
+    // Intentionally leaked, like the epoch context registry: worker isolates
+    // may still be running tasks while the process runs static destructors.
+    std::lock_guard<std::mutex> lock{shared_pool_mutex};
+    pool = shared_pool.load(std::memory_order_relaxed);
+    if (!pool)
+    {
+        pool = new thread_pool{shared_pool_options};
+        shared_pool.store(pool, std::memory_order_release);
+    }
+    return *pool;
+}
@@ -0,0 +1,185 @@
+/**
+ * Process-wide pool of worker threads with priority classes.
+ *
+ * Every heavy operation of the addon (epoch context builds, header and DAG
+ * verification) runs here instead of on the libuv threadpool, so a light
+ * cache build cannot hold up latency-sensitive verification. Each worker
+ * has its own queue per priority; a worker takes the most urgent task it
+ * can find, its own queue first, then stealing from the others.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Most urgent first. */
+enum task_priority
+{
+    priority_interactive = 0,  // Share and header verification.
+    priority_current_epoch = 1,  // Context builds somebody is waiting for.
+    priority_next_epoch = 2,  // Context builds ahead of need.
+    priority_background = 3,  // DAG generation and validation.
+};
+
+constexpr static int num_task_priorities = 4;
+
+struct thread_pool_options
+{
+    unsigned num_threads = 0;  // 0: hardware concurrency.
+    std::vector<int> cpus;  // Worker i is pinned to cpus[i % cpus.size()], empty: not pinned.
+};
+
+struct thread_pool_stats
+{
+    struct priority_class
+    {
+        uint64_t queued;  // Waiting right now.
+        uint64_t submitted;
+        uint64_t completed;
+        uint64_t total_wait_ns;  // Time in queue of the tasks started so far.
+        uint64_t max_wait_ns;
+    };
+
+    unsigned num_threads;
+    uint64_t steals;  // Tasks taken from another worker's queue.
+    priority_class classes[num_task_priorities];
+};
+
+class thread_pool
+{
+public:
+    explicit thread_pool(const thread_pool_options& options = {});
+
+    /** Runs the tasks still queued, then joins the workers. */
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /**
+     * Queues task. A waiter passing the same non-null group to wait() may
+     * run it inline; tasks without a group only ever run from the workers'
+     * own loop.
+     */
+    void submit(std::function<void()> task, task_priority priority, const void* group = nullptr);
+
+    unsigned size() const noexcept { return static_cast<unsigned>(threads_.size()); }
+
+    /** Whether the calling thread is one of this pool's workers. */
+    bool on_worker_thread() const noexcept;
+
+    /** Whether a task more urgent than priority is waiting. */
+    bool has_queued_above(task_priority priority) const noexcept;
+
+    /** Runs one queued task of group on the calling worker thread, false if none was found. */
+    bool run_one(const void* group);
+
+    /**
+     * cv.wait(lock, pred) that, on a worker thread, keeps running the
+     * queued tasks of group instead of blocking: the task that makes pred
+     * true may still be queued behind the waiter. Only the waiter's own
+     * subtasks are run, never unrelated or top-level work.
+     */
+    template <class Pred>
+    void wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cv, const void* group,
+        Pred pred)
+    {
+        if (!on_worker_thread())
+            return cv.wait(lock, pred);
+
+        while (!pred())
+        {
+            lock.unlock();
+            const bool ran = run_one(group);
+            lock.lock();
+            if (!ran && !pred())
+                cv.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+
+    /** future.get(), helping with the tasks of group like wait() above. */
+    template <class T>
+    T wait(const std::shared_future<T>& future, const void* group)
+    {
+        if (on_worker_thread())
+        {
+            while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                if (!run_one(group))
+                    future.wait_for(std::chrono::milliseconds(1));
+            }
+        }
+        return future.get();
+    }
+
+    thread_pool_stats stats() const noexcept;
+
+private:
+    struct task
+    {
+        std::function<void()> fn;
+        std::chrono::steady_clock::time_point queued_at;
+        const void* group;
+    };
+
+    struct worker_queue
+    {
+        std::mutex mutex;
+        std::deque<task> tasks[num_task_priorities];
+    };
+
+    void run(unsigned index, int cpu);
+    bool take(unsigned index, task& out, int& priority);
+    bool take_group(unsigned index, const void* group, task& out, int& priority);
+    void execute(task& t, int priority);
+
+    std::vector<std::unique_ptr<worker_queue>> queues_;
+    std::atomic<unsigned> next_queue_{0};  // Round robin for submits from outside.
+
+    std::atomic<uint64_t> queued_[num_task_priorities] = {};
+    std::atomic<uint64_t> total_queued_{0};
+    std::atomic<uint64_t> submitted_[num_task_priorities] = {};
+    std::atomic<uint64_t> completed_[num_task_priorities] = {};
+    std::atomic<uint64_t> total_wait_ns_[num_task_priorities] = {};
+    std::atomic<uint64_t> max_wait_ns_[num_task_priorities] = {};
+    std::atomic<uint64_t> steals_{0};
+
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    bool stop_ = false;  // Guarded by sleep_mutex_.
+    std::vector<std::thread> threads_;
+};
+
+/**
+ * Sets the size and affinity of the shared pool. Takes effect only before
+ * its first use, false afterwards.
+ */
+bool configure_shared_thread_pool(const thread_pool_options& options);
+
+/** The pool shared by every user in the process, started on first use. */
+thread_pool& shared_thread_pool();
@@ -0,0 +1,285 @@
+// Bulk PoW verification of a header stream with epoch-parallel context builds.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include "verify_pipeline.h"
+
+#include <algorithm>
+
+struct verify_pipeline::epoch_build
+{
+    int epoch_number;
+    hash256 seed;  // Walked by the pushing thread, see open_group().
+    epoch_context_ptr context;  // Set by the build task.
+    std::atomic<bool> started{false};  // A build may be queued twice, see open_group().
+    bool cancelled = false;  // Dropped before being claimed, guarded by the pipeline mutex.
+    bool done = false;  // Guarded by the pipeline mutex.
+    std::vector<std::shared_ptr<chunk>> waiting;  // Chunks queued before done.
+};
+
+struct verify_pipeline::epoch_group
+{
+    std::shared_ptr<epoch_build> build;
+    std::atomic<size_t> pending{1};  // Chunks in flight, +1 while the group is open.
+};
+
+struct verify_pipeline::chunk
+{
+    std::shared_ptr<epoch_group> group;
+    uint64_t first_index;
+    std::vector<header_to_verify> headers;
+};
+
+static verify_pipeline_options clamp_options(verify_pipeline_options options) noexcept
+{
+    options.lookahead = std::min(options.lookahead, max_pipeline_lookahead);
+    options.chunk_size = std::max<size_t>(options.chunk_size, 1);
+    return options;
+}
+
+verify_pipeline::verify_pipeline(const verify_pipeline_options& options, result_callback on_result)
+  : options_{clamp_options(options)}, on_result_{std::move(on_result)}, pool_{shared_thread_pool()}
+{}
+
+verify_pipeline::~verify_pipeline()
+{
+    finish();
+}
+
+void verify_pipeline::push(const header_to_verify& header)
+{
+    if (!open_group_ || open_group_->build->epoch_number != header.epoch_number)
+    {
+        flush_chunk();
+        close_group();
+        open_group(header.epoch_number);
+    }
+
+    if (pending_.empty())
+        pending_first_ = next_index_;
+    pending_.push_back(header);
+    ++next_index_;
+    if (pending_.size() >= options_.chunk_size)
+        flush_chunk();
+}
+
+void verify_pipeline::finish()
+{
+    flush_chunk();
+    close_group();
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    for (auto& b : builds_)
+        b.second->cancelled = true;  // Lookahead past the end of the stream.
+    builds_.clear();
+    pool_.wait(lock, cv_, this, [this] { return outstanding_tasks_ == 0; });
+}
+
+void verify_pipeline::open_group(int epoch_number)
+{
+    // Epochs without a context get no lookahead either.
+    int last_epoch = epoch_number;
+    if (epoch_number >= 0 && epoch_number <= max_epoch_number)
+        last_epoch = static_cast<int>(
+            std::min<int64_t>(int64_t{epoch_number} + options_.lookahead, max_epoch_number));
+
+    // The seeds of the group's epochs, walked forward from the previous
+    // group's without the mutex: sorted input costs one hash per epoch.
+    hash256 seeds[max_pipeline_lookahead + 1] = {};
+    if (epoch_number >= 0 && epoch_number <= max_epoch_number)
+    {
+        if (epoch_number < seed_epoch_)
+        {
+            seed_epoch_ = 0;
+            seed_ = {};
+        }
+        for (int e = epoch_number; e <= last_epoch; ++e)
+        {
+            for (; seed_epoch_ < e; ++seed_epoch_)
+                seed_ = ethash_keccak256_32(seed_.bytes);
+            seeds[e - epoch_number] = seed_;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock{mutex_};
+    pool_.wait(lock, cv_, this, [this] { return live_groups_ <= options_.lookahead; });
+
+    // Drop predictions the stream went past or jumped over.
+    for (auto it = builds_.begin(); it != builds_.end();)
+    {
+        if (it->first < epoch_number || it->first > last_epoch)
+        {
+            it->second->cancelled = true;
+            it = builds_.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    const bool predicted = builds_.find(epoch_number) != builds_.end();
+    for (int n = 0; n <= last_epoch - epoch_number; ++n)
+    {
+        if (builds_.find(epoch_number + n) == builds_.end())
+            schedule_build(epoch_number + n, seeds[n],
+                n == 0 ? priority_current_epoch : priority_next_epoch);
+    }
+
+    auto group = std::make_shared<epoch_group>();
+    auto it = builds_.find(epoch_number);
+
+    // A lookahead build still waiting in the pool is needed now: queue it
+    // again at the higher priority, whichever copy starts first builds.
+    if (predicted && !it->second->started)
+    {
+        ++outstanding_tasks_;
+        std::shared_ptr<epoch_build> build = it->second;
+        pool_.submit([this, build]() mutable { run_build(std::move(build)); },
+            priority_current_epoch, this);
+    }
+    group->build = std::move(it->second);
+    builds_.erase(it);
+    ++live_groups_;
+    open_group_ = std::move(group);
+}
+
+void verify_pipeline::close_group()
+{
+    if (!open_group_)
+        return;
+    release_group(*open_group_);
+    open_group_.reset();
+}
+
+void verify_pipeline::flush_chunk()
+{
+    if (pending_.empty())
+        return;
+
+    auto c = std::make_shared<chunk>();
+    c->group = open_group_;
+    c->first_index = pending_first_;
+    c->headers.swap(pending_);
+    pending_.reserve(options_.chunk_size);
+    ++open_group_->pending;
+
+    std::lock_guard<std::mutex> lock{mutex_};
+    epoch_build& build = *open_group_->build;
+    if (build.done)
+        dispatch(std::move(c));
+    else
+        build.waiting.push_back(std::move(c));
+}
+
+// Called with the mutex held.
+void verify_pipeline::schedule_build(int epoch_number, const hash256& seed, task_priority priority)
+{
+    auto build = std::make_shared<epoch_build>();
+    build->epoch_number = epoch_number;
+    build->seed = seed;
+    builds_.emplace(epoch_number, build);
+    if (epoch_number < 0 || epoch_number > max_epoch_number)
+    {
+        // Nothing to build, the headers get verify_no_context.
+        build->started = true;
+        build->done = true;
+        return;
+    }
+
+    ++outstanding_tasks_;
+    pool_.submit([this, build]() mutable { run_build(std::move(build)); }, priority, this);
+}
+
+void verify_pipeline::run_build(std::shared_ptr<epoch_build> build)
+{
+    bool cancelled;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        cancelled = build->cancelled;
+    }
+
+    if (!cancelled && !build->started.exchange(true))
+    {
+        epoch_context_ptr context{create_epoch_context(build->epoch_number, false, build->seed),
+            [this](epoch_context_full* c) {
+                destroy_epoch_context(c);
+                --live_contexts_;
+            }};
+        if (context)
+        {
+            ++num_contexts_built_;
+            const unsigned live = ++live_contexts_;
+            unsigned max = max_live_contexts_;
+            while (live > max && !max_live_contexts_.compare_exchange_weak(max, live))
+            {
+            }
+        }
+
+        std::vector<std::shared_ptr<chunk>> waiting;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            build->context = std::move(context);
+            build->done = true;
+            waiting.swap(build->waiting);
+            for (auto& c : waiting)
+                dispatch(std::move(c));
+        }
+    }
+
+    // Unclaimed builds die here, before the pipeline may be gone.
+    build.reset();
+    task_done();
+}
+
+// Called with the mutex held.
+void verify_pipeline::dispatch(std::shared_ptr<chunk> c)
+{
+    ++outstanding_tasks_;
+    pool_.submit([this, c]() mutable {
+        const epoch_context_full* const context = c->group->build->context.get();
+        for (size_t i = 0; i < c->headers.size(); ++i)
+        {
+            const header_to_verify& h = c->headers[i];
+            const int status = context ?
+                verify(*context, h.header_hash, h.mix_hash, h.nonce, h.boundary) :
+                verify_no_context;
+            on_result_(c->first_index + i, status);
+        }
+
+        release_group(*c->group);
+        c.reset();
+        task_done();
+    }, priority_interactive, this);
+}
+
+void verify_pipeline::release_group(epoch_group& group)
+{
+    if (--group.pending != 0)
+        return;
+
+    // Last chunk of a closed group: free the context now.
+    group.build.reset();
+    std::lock_guard<std::mutex> lock{mutex_};
+    --live_groups_;
+    cv_.notify_all();
+}
+
+void verify_pipeline::task_done()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    --outstanding_tasks_;
+    cv_.notify_all();
+}
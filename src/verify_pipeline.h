@@ -0,0 +1,125 @@
+/**
+ * Bulk PoW verification of a header stream, e.g. for resync or audits.
+ *
+ * Headers are grouped by epoch as they arrive. The context of the current
+ * epoch and of the next `lookahead` epochs are built on the shared pool
+ * ahead of need (the current one at priority_current_epoch, the others at
+ * priority_next_epoch), each group is verified in chunks at
+ * priority_interactive, and a context is freed
+ * as soon as the last chunk of its group is done. push() blocks while too
+ * many groups are in flight, so memory stays bounded for any stream length.
+ * Only consecutive headers of one epoch share a context: the input must be
+ * sorted by epoch (chain order), every switch back to an earlier epoch
+ * builds its context again. Lookahead builds the stream never reaches are
+ * cancelled if they have not started yet. Epochs outside [0,
+ * max_epoch_number] get verify_no_context.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ethash.h"
+#include "thread_pool.h"
+
+struct header_to_verify
+{
+    int epoch_number;
+    hash256 header_hash;
+    uint64_t nonce;
+    hash256 mix_hash;
+    hash256 boundary;
+};
+
+/** Most contexts built ahead, each one is a light cache in memory. */
+constexpr static unsigned max_pipeline_lookahead = 4;
+
+struct verify_pipeline_options
+{
+    unsigned lookahead = 2;  // Epoch contexts built ahead of the current one, clamped to
+                             // max_pipeline_lookahead.
+    size_t chunk_size = 1024;  // Headers per verification task.
+};
+
+class verify_pipeline
+{
+public:
+    /**
+     * Called once per header, from the pool threads and in no particular
+     * order, with the header's position in the stream and a
+     * verification_result.
+     */
+    using result_callback = std::function<void(uint64_t index, int status)>;
+
+    verify_pipeline(const verify_pipeline_options& options, result_callback on_result);
+
+    /** Waits for the headers pushed so far, see finish(). */
+    ~verify_pipeline();
+
+    /** Adds the next header of the stream, may block for back-pressure. */
+    void push(const header_to_verify& header);
+
+    /** Waits until every header pushed so far has its result. */
+    void finish();
+
+    unsigned num_contexts_built() const noexcept { return num_contexts_built_; }
+    unsigned max_live_contexts() const noexcept { return max_live_contexts_; }
+
+private:
+    struct epoch_build;
+    struct epoch_group;
+    struct chunk;
+
+    void open_group(int epoch_number);
+    void close_group();
+    void flush_chunk();
+    void schedule_build(int epoch_number, const hash256& seed, task_priority priority);
+    void run_build(std::shared_ptr<epoch_build> build);
+    void dispatch(std::shared_ptr<chunk> c);
+    void release_group(epoch_group& group);
+    void task_done();
+
+    const verify_pipeline_options options_;
+    const result_callback on_result_;
+    thread_pool& pool_;
+
+    // Only touched by the pushing thread.
+    std::shared_ptr<epoch_group> open_group_;
+    std::vector<header_to_verify> pending_;
+    uint64_t pending_first_ = 0;
+    uint64_t next_index_ = 0;
+    int seed_epoch_ = 0;  // Seeds are walked forward from the last epoch.
+    hash256 seed_ = {};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::map<int, std::shared_ptr<epoch_build>> builds_;  // Not claimed by a group yet.
+    size_t live_groups_ = 0;
+    size_t outstanding_tasks_ = 0;
+
+    std::atomic<unsigned> num_contexts_built_{0};
+    std::atomic<unsigned> live_contexts_{0};
+    std::atomic<unsigned> max_live_contexts_{0};
+};
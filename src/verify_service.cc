@@ -0,0 +1,515 @@
+// Local share verification service over POSIX shared memory.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include "verify_service.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "parallel.h"
+
+constexpr static uint64_t service_magic = 0x3376687465626c69;  // "libethv3"
+
+// client_slot::owner_pid values besides the owner's pid.
+constexpr static int32_t slot_free = 0;
+constexpr static int32_t slot_released = -1;  // Closed by its client, rings not reset yet.
+constexpr static int32_t slot_reclaiming = -2;  // Rings being reset by the service.
+
+struct client_slot
+{
+    std::atomic<int32_t> owner_pid;
+    std::atomic<uint32_t> in_flight;  // Submitted, response not polled yet.
+};
+
+struct service_segment
+{
+    std::atomic<uint64_t> magic;  // Stored last, once everything below is ready.
+    int32_t server_pid;
+    uint32_t request_capacity;
+    uint32_t response_capacity;
+    uint32_t max_clients;
+};
+
+struct segment_layout
+{
+    size_t slots;
+    size_t queues;  // Request then response ring of every client.
+    size_t responses;  // Offset of the response ring in a client's queues.
+    size_t queue_stride;
+    size_t size;
+};
+
+static size_t align_up(size_t x) noexcept
+{
+    return (x + cache_line_size - 1) & ~(cache_line_size - 1);
+}
+
+static segment_layout get_layout(
+    uint32_t request_capacity, uint32_t response_capacity, uint32_t max_clients) noexcept
+{
+    segment_layout l;
+    l.slots = align_up(sizeof(service_segment));
+    l.queues = align_up(l.slots + max_clients * sizeof(client_slot));
+    l.responses = align_up(mpmc_ring<verify_request>::storage_size(request_capacity));
+    l.queue_stride =
+        l.responses + align_up(mpmc_ring<verify_response>::storage_size(response_capacity));
+    l.size = l.queues + max_clients * l.queue_stride;
+    return l;
+}
+
+static bool process_alive(int32_t pid) noexcept
+{
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+/** Spins, then yields, then sleeps as a queue stays idle. */
+static void backoff(unsigned idle_rounds) noexcept
+{
+    if (idle_rounds < 64)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else if (idle_rounds < 128)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+static client_slot* get_slots(service_segment* segment, const segment_layout& l) noexcept
+{
+    return reinterpret_cast<client_slot*>(reinterpret_cast<char*>(segment) + l.slots);
+}
+
+/** Returns a credit taken by verify_client::submit(), never going below zero. */
+static void return_credit(client_slot& slot) noexcept
+{
+    uint32_t n = slot.in_flight.load(std::memory_order_relaxed);
+    while (n != 0 && !slot.in_flight.compare_exchange_weak(n, n - 1))
+    {
+    }
+}
+
+/**
+ * Whether a service is serving the name, looking at the segment header only:
+ * a service with every client slot taken is still running.
+ */
+static bool service_running(const std::string& name) noexcept
+{
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(service_segment))
+        mem = mmap(nullptr, sizeof(service_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+
+    const service_segment* const segment = static_cast<const service_segment*>(mem);
+    const bool running = segment->magic.load(std::memory_order_acquire) == service_magic &&
+                         process_alive(segment->server_pid);
+    munmap(mem, sizeof(service_segment));
+    return running;
+}
+
+static bool valid_epoch_window(int first_epoch, int last_epoch) noexcept
+{
+    return first_epoch >= 0 && first_epoch <= last_epoch && last_epoch <= max_epoch_number &&
+           last_epoch - first_epoch < max_service_epochs;
+}
+
+service_mapping::~service_mapping()
+{
+    if (segment_)
+        munmap(segment_, size_);
+}
+
+mpmc_ring<verify_request> service_mapping::requests(uint32_t client) const noexcept
+{
+    const segment_layout l = get_layout(
+        segment_->request_capacity, segment_->response_capacity, segment_->max_clients);
+    return mpmc_ring<verify_request>{
+        reinterpret_cast<char*>(segment_) + l.queues + client * l.queue_stride,
+        segment_->request_capacity};
+}
+
+mpmc_ring<verify_response> service_mapping::responses(uint32_t client) const noexcept
+{
+    const segment_layout l = get_layout(
+        segment_->request_capacity, segment_->response_capacity, segment_->max_clients);
+    return mpmc_ring<verify_response>{
+        reinterpret_cast<char*>(segment_) + l.queues + client * l.queue_stride + l.responses,
+        segment_->response_capacity};
+}
+
+std::unique_ptr<verify_service> verify_service::create(const verify_service_options& options)
+{
+    if (!is_power_of_two(options.request_capacity) ||
+        !is_power_of_two(options.response_capacity) || options.max_clients == 0 ||
+        options.max_clients > UINT16_MAX ||
+        !valid_epoch_window(options.first_epoch, options.last_epoch))
+    {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    const segment_layout l =
+        get_layout(options.request_capacity, options.response_capacity, options.max_clients);
+
+    int fd = shm_open(options.name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST)
+    {
+        // Take over the name only if the previous owner is gone.
+        if (service_running(options.name))
+        {
+            errno = EEXIST;
+            return nullptr;
+        }
+        shm_unlink(options.name.c_str());
+        fd = shm_open(options.name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && ftruncate(fd, static_cast<off_t>(l.size)) == 0)
+        mem = mmap(nullptr, l.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int saved_errno = errno;
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        shm_unlink(options.name.c_str());
+        errno = saved_errno;
+        return nullptr;
+    }
+
+    std::unique_ptr<verify_service> service{new verify_service};
+    service->name_ = options.name;
+    service->segment_dev_ = st.st_dev;
+    service->segment_ino_ = st.st_ino;
+    service->first_epoch_ = options.first_epoch;
+    service->last_epoch_ = options.last_epoch;
+    service->segment_ = static_cast<service_segment*>(mem);
+    service->size_ = l.size;
+
+    service_segment* const segment = new (mem) service_segment;
+    segment->server_pid = getpid();
+    segment->request_capacity = options.request_capacity;
+    segment->response_capacity = options.response_capacity;
+    segment->max_clients = options.max_clients;
+
+    client_slot* const slots = get_slots(segment, l);
+    service->busy_.reset(new std::atomic<unsigned>[options.max_clients]);
+    for (uint32_t i = 0; i < options.max_clients; ++i)
+    {
+        new (&slots[i].owner_pid) std::atomic<int32_t>{slot_free};
+        new (&slots[i].in_flight) std::atomic<uint32_t>{0};
+        service->requests(i).init();
+        service->responses(i).init();
+        service->busy_[i] = 0;
+    }
+    segment->magic.store(service_magic, std::memory_order_release);
+
+    const unsigned num_threads = options.num_threads ? options.num_threads : default_num_threads();
+    for (unsigned i = 0; i < num_threads; ++i)
+        service->threads_.emplace_back(&verify_service::run, service.get(), i);
+    service->reaper_ = std::thread{&verify_service::reap, service.get()};
+    return service;
+}
+
+verify_service::~verify_service()
+{
+    stop_ = true;
+    for (auto& t : threads_)
+        t.join();
+    reaper_.join();
+    segment_->magic.store(0, std::memory_order_release);
+
+    // Unlink the name only if it still refers to this segment.
+    const int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+    if (fd >= 0)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_dev) == segment_dev_ &&
+            static_cast<uint64_t>(st.st_ino) == segment_ino_)
+            shm_unlink(name_.c_str());
+        close(fd);
+    }
+}
+
+bool verify_service::set_epoch_window(int first_epoch, int last_epoch)
+{
+    if (!valid_epoch_window(first_epoch, last_epoch))
+        return false;
+
+    const int old_first = first_epoch_.exchange(first_epoch);
+    const int old_last = last_epoch_.exchange(last_epoch);
+    for (int e = old_first; e <= old_last; ++e)
+    {
+        if (e < first_epoch || e > last_epoch)
+            shared_epoch_contexts().release(e);
+    }
+    return true;
+}
+
+void verify_service::run(unsigned index) noexcept
+{
+    const uint32_t num_clients = segment_->max_clients;
+    epoch_context_ptr ctx;
+    uint32_t next = index % num_clients;  // Threads start their scan on different slots.
+    unsigned idle_rounds = 0;
+    while (!stop_.load(std::memory_order_relaxed))
+    {
+        bool served = false;
+        for (uint32_t n = 0; n < num_clients && !served; ++n)
+        {
+            const uint32_t client = (next + n) % num_clients;
+            if (serve(client, ctx))
+            {
+                served = true;
+                next = (client + 1) % num_clients;  // Round robin between clients.
+            }
+        }
+        if (served)
+            idle_rounds = 0;
+        else
+            backoff(idle_rounds++);
+    }
+}
+
+bool verify_service::serve(uint32_t client, epoch_context_ptr& ctx) noexcept
+{
+    const segment_layout l = get_layout(
+        segment_->request_capacity, segment_->response_capacity, segment_->max_clients);
+    client_slot& slot = get_slots(segment_, l)[client];
+    if (slot.owner_pid.load(std::memory_order_acquire) <= 0)
+        return false;
+
+    // Pin the slot: reap() resets its rings only once busy_ drops to zero
+    // after it marked the slot, so the order of these two is what matters.
+    busy_[client].fetch_add(1);
+    verify_request request;
+    const bool popped = slot.owner_pid.load() > 0 && requests(client).try_pop(request);
+    if (popped)
+    {
+        // Only epochs of the window are built: anything else a client sends
+        // must not grow the registry.
+        const int first_epoch = first_epoch_.load(std::memory_order_relaxed);
+        const int last_epoch = last_epoch_.load(std::memory_order_relaxed);
+        if (ctx && (ctx->epoch_number < first_epoch || ctx->epoch_number > last_epoch))
+            ctx.reset();
+
+        verify_response response{request.tag, request.epoch_number, verify_no_context, {}};
+        if (request.epoch_number >= first_epoch && request.epoch_number <= last_epoch)
+        {
+            // Consecutive requests are almost always for the same epoch.
+            if (!ctx || ctx->epoch_number != request.epoch_number)
+                ctx = shared_epoch_contexts().get(request.epoch_number);
+            if (ctx)
+            {
+                const result r = hash(*ctx, request.header_hash, request.nonce);
+                response.status =
+                    is_equal(r.mix_hash, request.mix_hash) ? verify_ok : verify_invalid_mix_hash;
+                response.final_hash = r.final_hash;
+            }
+        }
+        num_verified_.fetch_add(1, std::memory_order_relaxed);
+
+        // The client's credits leave room for this response. Never wait here:
+        // one slow client must not hold up the others.
+        if (!responses(client).try_push(response))
+        {
+            num_dropped_.fetch_add(1, std::memory_order_relaxed);
+            return_credit(slot);
+        }
+    }
+    busy_[client].fetch_sub(1);
+    return popped;
+}
+
+void verify_service::reap() noexcept
+{
+    const segment_layout l = get_layout(
+        segment_->request_capacity, segment_->response_capacity, segment_->max_clients);
+    client_slot* const slots = get_slots(segment_, l);
+
+    // Closed slots are cheap to spot, dead owners cost a syscall per slot.
+    for (unsigned round = 0; !stop_.load(std::memory_order_relaxed); ++round)
+    {
+        const bool check_owners = round % 10 == 0;
+        for (uint32_t i = 0; i < segment_->max_clients; ++i)
+        {
+            int32_t owner = slots[i].owner_pid.load(std::memory_order_acquire);
+            const bool gone =
+                owner == slot_released || (owner > 0 && check_owners && !process_alive(owner));
+            if (!gone || !slots[i].owner_pid.compare_exchange_strong(owner, slot_reclaiming))
+                continue;
+
+            // The owner may have died inside a push or a pop, leaving a cell
+            // claimed for good: start both rings over once no service thread
+            // is inside the slot.
+            while (busy_[i].load() != 0)
+                std::this_thread::yield();
+            requests(i).init();
+            responses(i).init();
+            slots[i].in_flight.store(0, std::memory_order_relaxed);
+            slots[i].owner_pid.store(slot_free, std::memory_order_release);
+            num_reclaimed_.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+std::unique_ptr<verify_client> verify_client::connect(const std::string& name)
+{
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void* mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0)
+    {
+        if (static_cast<size_t>(st.st_size) >= sizeof(service_segment))
+            mem = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        else
+            errno = EINVAL;
+    }
+    const int saved_errno = errno;
+    close(fd);
+    if (mem == MAP_FAILED)
+    {
+        errno = saved_errno;
+        return nullptr;
+    }
+
+    std::unique_ptr<verify_client> client{new verify_client};
+    client->segment_ = static_cast<service_segment*>(mem);
+    client->size_ = st.st_size;
+
+    service_segment* const segment = client->segment_;
+    if (segment->magic.load(std::memory_order_acquire) != service_magic ||
+        !process_alive(segment->server_pid))
+    {
+        errno = ECONNREFUSED;
+        return nullptr;
+    }
+    const segment_layout l = get_layout(
+        segment->request_capacity, segment->response_capacity, segment->max_clients);
+    if (l.size > client->size_)
+    {
+        errno = EINVAL;
+        return nullptr;
+    }
+
+    // Claim a free slot. The slot of a client that died is freed by the
+    // service, with fresh rings, within a fraction of a second.
+    client_slot* const slots = get_slots(segment, l);
+    const int32_t pid = getpid();
+    for (uint32_t i = 0; i < segment->max_clients; ++i)
+    {
+        int32_t owner = slot_free;
+        if (slots[i].owner_pid.compare_exchange_strong(owner, pid))
+        {
+            client->client_ = i;
+            client->slot_ = &slots[i];
+            return client;
+        }
+    }
+
+    errno = EBUSY;
+    return nullptr;
+}
+
+verify_client::~verify_client()
+{
+    // The service resets the rings before the slot is handed out again.
+    if (slot_ && segment_->magic.load(std::memory_order_acquire) == service_magic)
+    {
+        int32_t pid = getpid();
+        slot_->owner_pid.compare_exchange_strong(pid, slot_released);
+    }
+}
+
+bool verify_client::submit(uint64_t tag, int epoch_number, const hash256& header_hash,
+    uint64_t nonce, const hash256& mix_hash) noexcept
+{
+    verify_request request;
+    request.tag = tag;
+    request.epoch_number = epoch_number;
+    request.header_hash = header_hash;
+    request.nonce = nonce;
+    request.mix_hash = mix_hash;
+
+    // Take a credit first: the service relies on the room it guarantees in
+    // this client's response queue.
+    uint32_t in_flight = slot_->in_flight.load(std::memory_order_relaxed);
+    do
+    {
+        if (in_flight >= segment_->response_capacity)
+            return false;
+    } while (!slot_->in_flight.compare_exchange_weak(in_flight, in_flight + 1));
+
+    if (requests(client_).try_push(request))
+        return true;
+    return_credit(*slot_);
+    return false;
+}
+
+size_t verify_client::poll(std::vector<verify_response>& out, size_t max_responses)
+{
+    mpmc_ring<verify_response> queue = responses(client_);
+    size_t n = 0;
+    verify_response response;
+    while (n < max_responses && queue.try_pop(response))
+    {
+        return_credit(*slot_);
+        out.push_back(response);
+        ++n;
+    }
+    return n;
+}
+
+bool verify_client::ready() const noexcept
+{
+    return !responses(client_).empty();
+}
+
+bool verify_client::wait(int timeout_ms) const noexcept
+{
+    const mpmc_ring<verify_response> queue = responses(client_);
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    for (unsigned round = 0; queue.empty(); ++round)
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+            return false;
+        backoff(round);
+    }
+    return true;
+}
@@ -0,0 +1,172 @@
+/**
+ * Local share verification service over POSIX shared memory.
+ *
+ * One process (libeth-verifyd) owns the epoch contexts and creates a named
+ * shared memory segment. Client processes attach to it and claim a client
+ * slot, which has its own request and response queue; service threads take
+ * requests from every slot in turn, verify them against the shared epoch
+ * contexts and push the results back to the slot. The queues are lock-free
+ * rings, so the only syscalls on the hot path are the idle back-offs. A
+ * client may have at most response_capacity requests in flight, so the
+ * service never waits for room in a response queue and a client that stops
+ * polling only stalls itself.
+ *
+ * A client killed in the middle of a push or a pop can leave a ring cell
+ * claimed but never published. Since every ring belongs to one slot, that
+ * only wedges the dead client's own queues: the service notices the slot's
+ * owner is gone, waits until none of its threads is inside the slot and
+ * resets both rings before the slot can be claimed again.
+ *
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ethash.h"
+#include "shm_ring.h"
+
+struct verify_request
+{
+    uint64_t tag;  // Chosen by the client, echoed in the response.
+    int32_t epoch_number;
+    hash256 header_hash;
+    uint64_t nonce;
+    hash256 mix_hash;
+};
+
+struct verify_response
+{
+    uint64_t tag;
+    int32_t epoch_number;
+    int32_t status;  // verify_ok, verify_invalid_mix_hash or verify_no_context.
+    hash256 final_hash;  // Compare against the share/block boundary.
+};
+
+struct verify_service_options
+{
+    std::string name = "/libeth-verify";  // shm_open() name.
+    uint32_t request_capacity = 1 << 10;  // Per client, power of two.
+    uint32_t response_capacity = 1 << 12;  // Per client, power of two.
+    uint32_t max_clients = 64;
+    unsigned num_threads = 0;  // 0: hardware concurrency.
+    int first_epoch = 0;  // Requests outside [first_epoch, last_epoch] get
+    int last_epoch = -1;  // verify_no_context, see set_epoch_window().
+};
+
+/** Most epochs a service accepts at once, each one holds a light cache. */
+constexpr static int max_service_epochs = 64;
+
+struct client_slot;
+
+struct service_segment;
+
+/** Maps a service segment, the common part of server and client. */
+class service_mapping
+{
+public:
+    ~service_mapping();
+
+protected:
+    service_segment* segment_ = nullptr;
+    size_t size_ = 0;
+
+    mpmc_ring<verify_request> requests(uint32_t client) const noexcept;
+    mpmc_ring<verify_response> responses(uint32_t client) const noexcept;
+};
+
+class verify_service : service_mapping
+{
+public:
+    /** Creates the segment and starts the service threads, nullptr and errno on failure. */
+    static std::unique_ptr<verify_service> create(const verify_service_options& options);
+
+    /** Stops the threads and unlinks the segment name. */
+    ~verify_service();
+
+    /**
+     * Moves the window of accepted epochs and releases the contexts of the
+     * epochs that left it. False if the window is empty, outside [0,
+     * max_epoch_number] or wider than max_service_epochs.
+     */
+    bool set_epoch_window(int first_epoch, int last_epoch);
+
+    uint64_t num_verified() const noexcept { return num_verified_; }
+
+    /** Responses that found their queue full: the client ignored its credits. */
+    uint64_t num_dropped() const noexcept { return num_dropped_; }
+
+    /** Client slots reclaimed after their owner closed or died. */
+    uint64_t num_reclaimed() const noexcept { return num_reclaimed_; }
+
+private:
+    verify_service() = default;
+
+    void run(unsigned index) noexcept;
+    bool serve(uint32_t client, epoch_context_ptr& ctx) noexcept;
+    void reap() noexcept;
+
+    std::string name_;
+    uint64_t segment_dev_ = 0;  // Identity of the segment, the name may be
+    uint64_t segment_ino_ = 0;  // taken over once this service is gone.
+    std::atomic<int> first_epoch_{0};
+    std::atomic<int> last_epoch_{-1};
+    std::atomic<bool> stop_{false};
+    std::atomic<uint64_t> num_verified_{0};
+    std::atomic<uint64_t> num_dropped_{0};
+    std::atomic<uint64_t> num_reclaimed_{0};
+    std::unique_ptr<std::atomic<unsigned>[]> busy_;  // Service threads inside each slot.
+    std::vector<std::thread> threads_;
+    std::thread reaper_;
+};
+
+class verify_client : service_mapping
+{
+public:
+    /** Attaches to a running service, nullptr and errno on failure. */
+    static std::unique_ptr<verify_client> connect(const std::string& name);
+
+    /** Gives the client slot back. */
+    ~verify_client();
+
+    /**
+     * Queues a request, false if the service queue is full or response_capacity
+     * responses are waiting to be polled.
+     */
+    bool submit(uint64_t tag, int epoch_number, const hash256& header_hash, uint64_t nonce,
+        const hash256& mix_hash) noexcept;
+
+    /** Moves up to max_responses available responses into out. */
+    size_t poll(std::vector<verify_response>& out, size_t max_responses);
+
+    /** Whether a response is waiting to be polled. Safe from any thread. */
+    bool ready() const noexcept;
+
+    /** Waits until a response is available, false on timeout. Safe from any thread. */
+    bool wait(int timeout_ms) const noexcept;
+
+private:
+    verify_client() = default;
+
+    uint32_t client_ = 0;
+    client_slot* slot_ = nullptr;
+};
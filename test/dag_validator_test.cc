@@ -0,0 +1,152 @@
+// Tests of the sampled DAG validator.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include <stdio.h>
+
+#include <cstring>
+#include <future>
+#include <vector>
+
+#include "check.h"
+#include "dag_validator.h"
+
+// The first items of the epoch 0 dataset, an odd count so the last pair is short.
+constexpr static uint32_t num_items = 2001;
+
+static std::vector<uint8_t> make_dump(const epoch_context& context)
+{
+    std::vector<uint8_t> dump(num_items * sizeof(hash1024));
+    for (uint32_t i = 0; i < num_items; ++i)
+    {
+        const hash1024 item = calculate_dataset_item_1024(context, i);
+        memcpy(&dump[i * sizeof(hash1024)], item.bytes, sizeof(item));
+    }
+    return dump;
+}
+
+static dag_validation_report validate(const epoch_context& context,
+    const std::vector<uint8_t>& dump, dag_sample_order order, double rate, uint64_t seed = 0)
+{
+    dag_validation_options options;
+    options.order = order;
+    options.sample_rate = rate;
+    options.seed = seed;
+    return validate_dag(context, dump.data(), dump.size(), options);
+}
+
+static void test_good_dump(const epoch_context& context, const std::vector<uint8_t>& dump)
+{
+    const dag_validation_report full = validate(context, dump, dag_sample_full, 0);
+    CHECK(!full.size_ok);
+    CHECK(full.items_checked == num_items);
+    CHECK(full.items_mismatched == 0);
+
+    const dag_validation_report random = validate(context, dump, dag_sample_random, 0.5);
+    CHECK(random.items_checked >= 2 * 501 - 1 && random.items_checked <= 2 * 501);
+    CHECK(random.items_mismatched == 0);
+}
+
+static void test_corrupt_item(const epoch_context& context, std::vector<uint8_t> dump)
+{
+    dump[1234 * sizeof(hash1024) + 5] ^= 1;
+    const dag_validation_report full = validate(context, dump, dag_sample_full, 0);
+    CHECK(full.items_mismatched == 1);
+    CHECK(full.mismatches.size() == 1);
+    if (full.mismatches.size() == 1)
+        CHECK(full.mismatches[0].first == 1234 && full.mismatches[0].last == 1234);
+}
+
+static void test_random_without_replacement(
+    const epoch_context& context, std::vector<uint8_t> dump)
+{
+    // Every item is bad: a pair sampled twice would be counted twice in
+    // items_checked but only once in the de-duplicated mismatches.
+    for (uint32_t i = 0; i < num_items; ++i)
+        dump[i * sizeof(hash1024)] ^= 1;
+
+    for (uint64_t seed = 0; seed < 8; ++seed)
+    {
+        const dag_validation_report some = validate(context, dump, dag_sample_random, 0.3, seed);
+        CHECK(some.items_checked > 0);
+        CHECK(some.items_mismatched == some.items_checked);
+
+        const dag_validation_report all = validate(context, dump, dag_sample_random, 1.0, seed);
+        CHECK(all.items_checked == num_items);
+        CHECK(all.items_mismatched == num_items);
+        CHECK(all.mismatches.size() == 1);
+    }
+
+    // Dumps of a few pairs only.
+    for (size_t items = 1; items <= 7; ++items)
+    {
+        const std::vector<uint8_t> small(dump.begin(), dump.begin() + items * sizeof(hash1024));
+        const dag_validation_report report = validate(context, small, dag_sample_random, 1.0, items);
+        CHECK(report.items_checked == items);
+        CHECK(report.items_mismatched == items);
+    }
+}
+
+// The async variant reports like validate_dag() without a thread waiting
+// for it, and skips what is left once cancelled.
+static void test_async(const epoch_context_ptr& context, std::vector<uint8_t> dump)
+{
+    dump[17 * sizeof(hash1024)] ^= 1;
+    dump[1999 * sizeof(hash1024)] ^= 1;
+
+    dag_validation_options options;
+    options.order = dag_sample_full;
+    std::promise<dag_validation_report> result;
+    validate_dag_async(context, dump.data(), dump.size(), options,
+        [&](const dag_validation_report& report) { result.set_value(report); });
+    const dag_validation_report report = result.get_future().get();
+    CHECK(report.items_checked == num_items);
+    CHECK(report.items_mismatched == 2);
+    CHECK(report.mismatches.size() == 2);
+
+    bool empty_done = false;
+    validate_dag_async(context, nullptr, 0, options, [&](const dag_validation_report& r) {
+        empty_done = r.items_checked == 0 && !r.size_ok;
+    });
+    CHECK(empty_done);
+
+    std::atomic<bool> cancel{true};
+    options.cancel = &cancel;
+    std::promise<dag_validation_report> cancelled;
+    validate_dag_async(context, dump.data(), dump.size(), options,
+        [&](const dag_validation_report& r) { cancelled.set_value(r); });
+    CHECK(cancelled.get_future().get().items_checked == 0);
+
+    CHECK(!validate_dag_file_async(context, "/nonexistent/dag.bin", options,
+        [](const dag_validation_report&) { CHECK(false); }));
+}
+
+int main()
+{
+    epoch_context_full* const context = create_epoch_context(0, false);
+    CHECK(context);
+    if (!context)
+        return 1;
+
+    const std::vector<uint8_t> dump = make_dump(*context);
+    test_good_dump(*context, dump);
+    test_corrupt_item(*context, dump);
+    test_random_without_replacement(*context, dump);
+    test_async(epoch_context_ptr{context, destroy_epoch_context}, dump);
+
+    return check_result("dag_validator_test");
+}
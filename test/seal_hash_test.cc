@@ -0,0 +1,175 @@
+// Tests of the header seal hashes and the multi-buffer Keccak behind them.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include <stdio.h>
+
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "keccak_x4.h"
+#include "seal_hash.h"
+#include "share_grading.h"
+
+static void from_hex(const char* hex, uint8_t* out, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        unsigned byte = 0;
+        sscanf(hex + 2 * i, "%2x", &byte);
+        out[i] = static_cast<uint8_t>(byte);
+    }
+}
+
+static hash256 hash_from_hex(const char* hex)
+{
+    hash256 h;
+    from_hex(hex, h.bytes, sizeof(h));
+    return h;
+}
+
+/** Big-endian, zero-padded on the left. */
+static void store_be(uint8_t* out, size_t size, uint64_t value)
+{
+    memset(out, 0, size);
+    for (size_t i = 0; i < 8 && i < size; ++i)
+        out[size - 1 - i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+// Mainnet block 1.
+static seal_header_record block_1()
+{
+    seal_header_record r = {};
+    from_hex("d4e56740f876aef8c010b86a40d5f56745a118d0906a34e69aec8c0db1cb8fa3", r.parent_hash, 32);
+    from_hex("1dcc4de8dec75d7aab85b567b6ccd41ad312451b948a7413f0a142fd40d49347", r.ommers_hash, 32);
+    from_hex("05a56e2d52c817161883f50c441c3228cfe54d9f", r.beneficiary, 20);
+    from_hex("d67e4d450343046425ae4271474353857ab860dbc0a1dde64b41b5cd3a532bf3", r.state_root, 32);
+    from_hex("56e81f171bcc55a6ff8345e692c0f86e5b48e01b996cadc001622fb5e363b421",
+        r.transactions_root, 32);
+    from_hex("56e81f171bcc55a6ff8345e692c0f86e5b48e01b996cadc001622fb5e363b421",
+        r.receipts_root, 32);
+    store_be(r.difficulty, sizeof(r.difficulty), 17171480576);
+    store_be(r.number, sizeof(r.number), 1);
+    store_be(r.gas_limit, sizeof(r.gas_limit), 5000);
+    store_be(r.gas_used, sizeof(r.gas_used), 0);
+    store_be(r.timestamp, sizeof(r.timestamp), 1438269988);
+    static const char extra[] = "Geth/v1.0.0/linux/go1.4.2";
+    r.extra_data_size = sizeof(extra) - 1;
+    memcpy(r.extra_data, extra, r.extra_data_size);
+    return r;
+}
+
+// The seal hash of block 1 is the one its Ethash seal was mined over.
+static void test_block_1()
+{
+    const seal_header_record record = block_1();
+    hash256 seal;
+    CHECK(seal_hashes(&record, 1, &seal) == 1);
+    CHECK(is_equal(seal,
+        hash_from_hex("85913a3057ea8bec78cd916871ca73802e77724e014dda65add3405d02240eb7")));
+
+    uint8_t encoding[seal_header_max_rlp_size];
+    const size_t size = rlp_encode_seal_header(record, encoding);
+    CHECK(size > 0 && is_equal(ethash_keccak256(encoding, size), seal));
+
+    epoch_context_ptr context{create_epoch_context(0, false), destroy_epoch_context};
+    CHECK(context != nullptr);
+    if (context)
+    {
+        const hash256 mix =
+            hash_from_hex("969b900de27b6ac6a67742365dd65f55a0526c41fd18e1b16f1a1215c2e66f59");
+        CHECK(verify(*context, seal, mix, 0x539bd4979fef1ec4,
+                  difficulty_to_boundary(uint64_t{17171480576})) == verify_ok);
+    }
+
+    // A batch hashes like the records one by one, an invalid record is
+    // reported and the others still hashed.
+    std::vector<seal_header_record> records(70, record);
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        store_be(records[i].number, sizeof(records[i].number), i);
+        records[i].extra_data_size = static_cast<uint8_t>(i % 33);
+        if (i % 3 == 0)
+            records[i].flags = seal_header_has_base_fee;
+        store_be(records[i].base_fee, sizeof(records[i].base_fee), i * 1000);
+    }
+    records[66].extra_data_size = 33;
+    std::vector<hash256> hashes(records.size());
+    CHECK(seal_hashes(records.data(), records.size(), hashes.data()) == 66);
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const size_t n = rlp_encode_seal_header(records[i], encoding);
+        if (i == 66)
+            CHECK(n == 0 && is_equal(hashes[i], hash256{}));
+        else
+            CHECK(n > 0 && is_equal(hashes[i], ethash_keccak256(encoding, n)));
+    }
+}
+
+// The four lanes of keccak256_x4() match the scalar Keccak for messages
+// ending right before, on and right after each block boundary, where the
+// padding either shares the last block or takes a block of its own.
+static void test_x4_block_boundaries()
+{
+    constexpr size_t max_size = 4 * keccak256_block_size + 1;
+    std::vector<uint8_t> data(max_size);
+    for (size_t i = 0; i < max_size; ++i)
+        data[i] = static_cast<uint8_t>(i * 131 + 7);
+
+    for (size_t blocks = 0; blocks <= 4; ++blocks)
+    {
+        for (size_t delta : {size_t{0}, size_t{1}, size_t{2}})
+        {
+            const size_t end = blocks * keccak256_block_size;
+            if (end + delta < 1)
+                continue;
+            const size_t size = end + delta - 1;
+
+            uint8_t buffers[4][max_size + keccak256_block_size];
+            const uint8_t* lanes[4];
+            size_t num_blocks = 0;
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                // Differ in the first byte so that lanes can't be mixed up.
+                memcpy(buffers[lane], data.data(), size);
+                if (size > 0)
+                    buffers[lane][0] ^= static_cast<uint8_t>(lane);
+                num_blocks = keccak256_pad(buffers[lane], size);
+                lanes[lane] = buffers[lane];
+            }
+            CHECK(num_blocks == size / keccak256_block_size + 1);
+
+            hash256 out[4];
+            keccak256_x4(lanes, num_blocks, out);
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                std::vector<uint8_t> message(data.begin(), data.begin() + size);
+                if (size > 0)
+                    message[0] ^= static_cast<uint8_t>(lane);
+                CHECK(is_equal(out[lane], ethash_keccak256(message.data(), size)));
+            }
+        }
+    }
+}
+
+int main()
+{
+    test_block_1();
+    test_x4_block_boundaries();
+    return check_result("seal_hash_test");
+}
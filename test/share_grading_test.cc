@@ -0,0 +1,189 @@
+// Tests of the difficulty boundaries and the share grader.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include <stdio.h>
+
+#include <cstring>
+#include <random>
+
+#include "check.h"
+#include "share_grading.h"
+
+/** The big-endian 256-bit value with only bit set. */
+static hash256 power_of_two(int bit)
+{
+    hash256 h = {};
+    h.bytes[31 - bit / 8] = static_cast<uint8_t>(1u << (bit % 8));
+    return h;
+}
+
+static hash256 filled(uint8_t byte)
+{
+    hash256 h;
+    memset(h.bytes, byte, sizeof(h));
+    return h;
+}
+
+static hash256 from_uint64(uint64_t value)
+{
+    hash256 h = {};
+    for (int i = 0; i < 8; ++i)
+        h.bytes[31 - i] = static_cast<uint8_t>(value >> (8 * i));
+    return h;
+}
+
+/** Big-endian value + 1, wrapping. */
+static hash256 increment(hash256 h)
+{
+    for (int i = 31; i >= 0 && ++h.bytes[i] == 0; --i)
+    {
+    }
+    return h;
+}
+
+/**
+ * Checks floor(2^256 / d) for a 64-bit d: q * d <= 2^256 < (q + 1) * d, with
+ * the products computed in five 64-bit limbs.
+ */
+static bool is_boundary_of(const hash256& q, uint64_t d)
+{
+    uint64_t product[5] = {};  // Least significant first.
+    unsigned __int128 carry = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        uint64_t limb = 0;
+        for (int b = 0; b < 8; ++b)
+            limb |= uint64_t{q.bytes[31 - 8 * i - b]} << (8 * b);
+        carry += static_cast<unsigned __int128>(limb) * d;
+        product[i] = static_cast<uint64_t>(carry);
+        carry >>= 64;
+    }
+    product[4] = static_cast<uint64_t>(carry);
+
+    // q * d <= 2^256: either exactly 2^256 or below it.
+    const bool below = product[4] == 0;
+    const bool exact = product[4] == 1 && !(product[0] | product[1] | product[2] | product[3]);
+    if (!below && !exact)
+        return false;
+    if (exact)
+        return true;
+
+    // (q + 1) * d = q * d + d > 2^256 - 1, i.e. adding d overflows 256 bits.
+    unsigned __int128 sum = static_cast<unsigned __int128>(product[0]) + d;
+    for (int i = 1; i < 4; ++i)
+        sum = (sum >> 64) + product[i];
+    return (sum >> 64) != 0;
+}
+
+static void test_small_difficulties()
+{
+    // 0 and 1 saturate.
+    CHECK(is_equal(difficulty_to_boundary(uint64_t{0}), filled(0xff)));
+    CHECK(is_equal(difficulty_to_boundary(uint64_t{1}), filled(0xff)));
+    CHECK(is_equal(difficulty_to_boundary(hash256{}), filled(0xff)));
+
+    CHECK(is_equal(difficulty_to_boundary(uint64_t{2}), power_of_two(255)));
+    CHECK(is_equal(difficulty_to_boundary(uint64_t{3}), filled(0x55)));
+    CHECK(is_equal(difficulty_to_boundary(uint64_t{15}), filled(0x11)));
+}
+
+// 2^256 / 2^k is exact, the case the off-by-one correction is for.
+static void test_powers_of_two()
+{
+    for (int k = 1; k < 256; ++k)
+    {
+        const hash256 boundary = difficulty_to_boundary(power_of_two(k));
+        CHECK(is_equal(boundary, power_of_two(256 - k)));
+        if (k < 64)
+            CHECK(is_equal(difficulty_to_boundary(uint64_t{1} << k), boundary));
+    }
+}
+
+static void test_full_width()
+{
+    // 2^256 - 1 and everything above 2^255 give 1; 2^255 itself gives 2.
+    CHECK(is_equal(difficulty_to_boundary(filled(0xff)), from_uint64(1)));
+    CHECK(is_equal(difficulty_to_boundary(increment(power_of_two(255))), from_uint64(1)));
+    CHECK(is_equal(difficulty_to_boundary(power_of_two(255)), from_uint64(2)));
+
+    // 2^256 / (2^128 + 1) = 2^128 - 1, the remainder 1 is dropped.
+    hash256 max_128 = {};
+    memset(max_128.bytes + 16, 0xff, 16);
+    CHECK(is_equal(difficulty_to_boundary(increment(power_of_two(128))), max_128));
+
+    // 2^256 / (2^256 / 3 rounded up) = 2.
+    CHECK(is_equal(difficulty_to_boundary(increment(filled(0x55))), from_uint64(2)));
+
+    std::mt19937_64 rng{1};
+    for (int i = 0; i < 1000; ++i)
+    {
+        const uint64_t d = rng() >> (rng() % 64);
+        const hash256 boundary = difficulty_to_boundary(d);
+        if (d > 1)
+            CHECK(is_boundary_of(boundary, d));
+        CHECK(is_equal(boundary, difficulty_to_boundary(from_uint64(d))));
+        CHECK(is_equal(shared_boundary_cache().get(from_uint64(d)), boundary));
+    }
+}
+
+static void test_grader()
+{
+    const hash256 easy = difficulty_to_boundary(uint64_t{1000});
+    const hash256 hard = difficulty_to_boundary(uint64_t{4000});
+
+    // Out of order, with the hard boundary given twice: a hash meeting it
+    // gets the tier of the last of the equal boundaries.
+    const hash256 boundaries[] = {hard, easy, hard};
+    const share_grader grader{boundaries, 3};
+
+    CHECK(grader.grade(hard) == 3);  // Meeting a boundary exactly counts.
+    CHECK(grader.grade(increment(hard)) == 2);
+    CHECK(grader.grade(easy) == 2);
+    CHECK(grader.grade(increment(easy)) == 0);
+    CHECK(grader.grade(hash256{}) == 3);
+    CHECK(grader.grade(filled(0xff)) == 0);
+
+    // Every boundary equal.
+    const hash256 same[] = {easy, easy, easy, easy};
+    const share_grader all_same{same, 4};
+    CHECK(all_same.grade(easy) == 4);
+    CHECK(all_same.grade(increment(easy)) == 0);
+
+    // The saturated boundary of difficulty 0 and 1 takes every hash.
+    const hash256 any[] = {difficulty_to_boundary(uint64_t{1}), hard};
+    const share_grader lenient{any, 2};
+    CHECK(lenient.grade(filled(0xff)) == 1);
+    CHECK(lenient.grade(hard) == 2);
+
+    const hash256 hashes[] = {filled(0xff), easy, hard, hash256{}};
+    uint8_t tiers[4];
+    grader.grade(hashes, 4, tiers);
+    CHECK(tiers[0] == 0 && tiers[1] == 2 && tiers[2] == 3 && tiers[3] == 3);
+
+    const share_grader none{boundaries, 0};
+    CHECK(none.grade(hash256{}) == 0);
+}
+
+int main()
+{
+    test_small_difficulties();
+    test_powers_of_two();
+    test_full_width();
+    test_grader();
+    return check_result("share_grading_test");
+}
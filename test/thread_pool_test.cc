@@ -0,0 +1,194 @@
+// Tests of the shared thread pool and the pipeline running on it.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include <stdio.h>
+
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "parallel.h"
+#include "thread_pool.h"
+#include "verify_pipeline.h"
+
+// On a single worker, a waiter runs its own queued subtasks but leaves
+// unrelated tasks, more urgent ones included, to the worker's own loop.
+static void test_helping()
+{
+    thread_pool_options options;
+    options.num_threads = 1;
+    thread_pool pool{options};
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto record = [&](const char* name) {
+        std::lock_guard<std::mutex> lock{mutex};
+        order.push_back(name);
+    };
+
+    std::promise<void> done;
+    pool.submit([&] {
+        int group;
+        std::promise<int> result;
+        std::shared_future<int> future = result.get_future().share();
+        pool.submit([&] { record("other"); }, priority_interactive);
+        pool.submit([&] { record("unrelated"); }, priority_background, &order);
+        pool.submit([&] {
+            record("subtask");
+            result.set_value(42);
+        }, priority_background, &group);
+        CHECK(pool.wait(future, &group) == 42);
+        record("waiter");
+
+        std::condition_variable cv;
+        bool flag = false;
+        pool.submit([&] {
+            std::lock_guard<std::mutex> lock{mutex};
+            order.push_back("cv subtask");
+            flag = true;
+            cv.notify_all();
+        }, priority_next_epoch, &group);
+        std::unique_lock<std::mutex> lock{mutex};
+        pool.wait(lock, cv, &group, [&] { return flag; });
+        order.push_back("cv waiter");
+        lock.unlock();
+        done.set_value();
+    }, priority_current_epoch);
+    done.get_future().wait();
+
+    while (pool.stats().classes[priority_background].completed != 2)
+        std::this_thread::yield();
+    std::lock_guard<std::mutex> lock{mutex};
+    const std::vector<std::string> expected = {
+        "subtask", "waiter", "cv subtask", "cv waiter", "other", "unrelated"};
+    CHECK(order == expected);
+}
+
+// A pipeline driven from a pool task, as the addon does, must not deadlock
+// on a single worker: its builds and chunks are helped by its own waits.
+static void test_pipeline_on_worker()
+{
+    thread_pool_options options;
+    options.num_threads = 1;
+    CHECK(configure_shared_thread_pool(options));
+
+    std::vector<int> statuses(5, 99);
+    std::promise<unsigned> built;
+    shared_thread_pool().submit([&] {
+        verify_pipeline_options o;
+        verify_pipeline pipeline{o, [&](uint64_t i, int status) { statuses[i] = status; }};
+        header_to_verify h = {};
+        h.epoch_number = 0;
+        pipeline.push(h);
+        pipeline.push(h);
+        h.epoch_number = max_epoch_number + 1;
+        pipeline.push(h);
+        h.epoch_number = -1;
+        pipeline.push(h);
+        h.epoch_number = 2147483647;
+        pipeline.push(h);
+        pipeline.finish();
+        built.set_value(pipeline.num_contexts_built());
+    }, priority_interactive);
+
+    // Only epoch 0, the lookahead build of epoch 1 is cancelled before it starts.
+    CHECK(built.get_future().get() == 1);
+    CHECK(statuses[0] == verify_invalid_final_hash && statuses[1] == verify_invalid_final_hash);
+    for (size_t i = 2; i < statuses.size(); ++i)
+        CHECK(statuses[i] == verify_no_context);
+}
+
+// On a single worker, a long parallel_for_async() range gives way to an
+// interactive task queued midway instead of holding the worker to the end.
+static void test_parallel_for_async_yields()
+{
+    constexpr uint64_t count = 200;
+    std::vector<std::atomic<int>> visits(count);
+    std::atomic<uint64_t> visited{0};
+    std::atomic<uint64_t> visited_before_urgent{count};
+    std::promise<void> done;
+
+    parallel_for_async(priority_background, 0, count, 0, 1,
+        [&](uint64_t i) {
+            ++visits[i];
+            if (++visited == 10)
+            {
+                shared_thread_pool().submit(
+                    [&] { visited_before_urgent = visited.load(); }, priority_interactive);
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        },
+        [&] { done.set_value(); });
+
+    done.get_future().wait();
+    CHECK(visited_before_urgent < count);
+    for (const std::atomic<int>& v : visits)
+        CHECK(v == 1);
+
+    // An empty range completes inline.
+    bool empty_done = false;
+    parallel_for_async(priority_background, 5, 5, 0, 1, [](uint64_t) {}, [&] { empty_done = true; });
+    CHECK(empty_done);
+}
+
+// Seeds are walked forward across groups and restart on a jump back: a
+// valid share of every epoch must verify, lookahead clamped or not.
+static void test_pipeline_seeds()
+{
+    const int epochs[] = {0, 1, 2, 1};
+    std::vector<header_to_verify> headers;
+    for (const int epoch : epochs)
+    {
+        epoch_context_full* const context = create_epoch_context(epoch, false);
+        CHECK(context);
+        if (!context)
+            return;
+        header_to_verify h = {};
+        h.epoch_number = epoch;
+        h.header_hash.bytes[0] = static_cast<uint8_t>(epoch + 1);
+        h.nonce = 0x4242424242424242;
+        h.mix_hash = hash(*context, h.header_hash, h.nonce).mix_hash;
+        memset(h.boundary.bytes, 0xff, sizeof(h.boundary));
+        headers.push_back(h);
+        destroy_epoch_context(context);
+    }
+
+    verify_pipeline_options o;
+    o.lookahead = 1000;
+    std::vector<int> statuses(headers.size(), 99);
+    verify_pipeline pipeline{o, [&](uint64_t i, int status) { statuses[i] = status; }};
+    for (const header_to_verify& h : headers)
+        pipeline.push(h);
+    pipeline.finish();
+    for (const int status : statuses)
+        CHECK(status == verify_ok);
+    CHECK(pipeline.max_live_contexts() <= max_pipeline_lookahead + 1);
+}
+
+int main()
+{
+    test_helping();
+    test_pipeline_on_worker();
+    test_parallel_for_async_yields();
+    test_pipeline_seeds();
+
+    return check_result("thread_pool_test");
+}
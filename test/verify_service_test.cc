@@ -0,0 +1,320 @@
+// Tests of the shared memory ring and the verification service.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "shm_ring.h"
+#include "verify_service.h"
+
+static std::string segment_name(const char* test)
+{
+    return "/libeth-test-" + std::to_string(getpid()) + "-" + test;
+}
+
+// Epoch 0 share from the ethash test vectors.
+static const uint8_t header_hash_0[32] = {0x2a, 0x8d, 0xe2, 0xad, 0xf8, 0x9a, 0xf7, 0x73, 0x58,
+    0x25, 0x0b, 0xf9, 0x08, 0xbf, 0x04, 0xba, 0x94, 0xa6, 0xe8, 0xc3, 0xba, 0x87, 0x77, 0x55, 0x64,
+    0xa4, 0x1d, 0x26, 0x9a, 0x05, 0xe4, 0xce};
+static const uint8_t mix_hash_0[32] = {0x58, 0xf7, 0x59, 0xed, 0xe1, 0x7a, 0x70, 0x6c, 0x93, 0xf1,
+    0x30, 0x30, 0x32, 0x8b, 0xce, 0xa4, 0x0c, 0x1d, 0x13, 0x41, 0xfb, 0x26, 0xf2, 0xfa, 0xcd, 0x21,
+    0xce, 0xb0, 0xda, 0xe5, 0x70, 0x17};
+constexpr static uint64_t nonce_0 = 0x4242424242424242;
+
+static bool submit(verify_client& client, uint64_t tag, int epoch_number)
+{
+    hash256 header_hash, mix_hash;
+    memcpy(header_hash.bytes, header_hash_0, sizeof(header_hash));
+    memcpy(mix_hash.bytes, mix_hash_0, sizeof(mix_hash));
+    return client.submit(tag, epoch_number, header_hash, nonce_0, mix_hash);
+}
+
+/** Polls until n responses arrived or timeout_ms passed. */
+static std::vector<verify_response> receive(verify_client& client, size_t n, int timeout_ms)
+{
+    std::vector<verify_response> out;
+    while (out.size() < n && client.wait(timeout_ms))
+        client.poll(out, n - out.size());
+    return out;
+}
+
+/** Connects, waiting up to timeout_ms for a slot to be freed. */
+static std::unique_ptr<verify_client> connect_retry(const std::string& name, int timeout_ms)
+{
+    for (int waited = 0;; waited += 5)
+    {
+        auto client = verify_client::connect(name);
+        if (client || errno != EBUSY || waited >= timeout_ms)
+            return client;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+static void test_ring()
+{
+    constexpr uint64_t capacity = 4;
+    std::vector<char> storage(mpmc_ring<uint64_t>::storage_size(capacity));
+    mpmc_ring<uint64_t> ring{storage.data(), capacity};
+    ring.init();
+
+    CHECK(ring.empty());
+    for (uint64_t i = 0; i < capacity; ++i)
+        CHECK(ring.try_push(i));
+    CHECK(!ring.try_push(capacity));
+    uint64_t v = 0;
+    for (uint64_t i = 0; i < capacity; ++i)
+        CHECK(ring.try_pop(v) && v == i);
+    CHECK(!ring.try_pop(v));
+    CHECK(ring.empty());
+}
+
+static void test_ring_threads()
+{
+    constexpr uint64_t capacity = 64;
+    constexpr uint64_t per_producer = 100000;
+    std::vector<char> storage(mpmc_ring<uint64_t>::storage_size(capacity));
+    mpmc_ring<uint64_t> ring{storage.data(), capacity};
+    ring.init();
+
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> popped{0};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < 2; ++p)
+    {
+        threads.emplace_back([&] {
+            for (uint64_t i = 1; i <= per_producer; ++i)
+            {
+                while (!ring.try_push(i))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (int c = 0; c < 2; ++c)
+    {
+        threads.emplace_back([&] {
+            uint64_t v;
+            while (popped.load() < 2 * per_producer)
+            {
+                if (ring.try_pop(v))
+                {
+                    sum += v;
+                    ++popped;
+                }
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    CHECK(sum == per_producer * (per_producer + 1));
+}
+
+static void test_verify()
+{
+    verify_service_options options;
+    options.name = segment_name("verify");
+    options.num_threads = 2;
+    options.first_epoch = 0;
+    options.last_epoch = 0;
+    auto service = verify_service::create(options);
+    CHECK(service);
+    if (!service)
+        return;
+    auto client = verify_client::connect(options.name);
+    CHECK(client);
+    if (!client)
+        return;
+
+    CHECK(submit(*client, 1, 0));
+    CHECK(submit(*client, 2, 1));  // Outside the window.
+    const std::vector<verify_response> responses = receive(*client, 2, 60000);
+    CHECK(responses.size() == 2);
+    for (const verify_response& r : responses)
+    {
+        if (r.tag == 1)
+            CHECK(r.status == verify_ok && r.final_hash.bytes[0] == 0xdd);
+        else
+            CHECK(r.tag == 2 && r.status == verify_no_context);
+    }
+
+    CHECK(!service->set_epoch_window(5, 4));
+    CHECK(!service->set_epoch_window(-1, 0));
+    CHECK(!service->set_epoch_window(0, max_service_epochs));
+    CHECK(service->set_epoch_window(1, 2));
+}
+
+// A client that stops polling must not hold up the others.
+static void test_slow_client()
+{
+    verify_service_options options;
+    options.name = segment_name("slow");
+    options.num_threads = 2;
+    options.response_capacity = 4;
+    options.first_epoch = 0;
+    options.last_epoch = 0;
+    auto service = verify_service::create(options);
+    CHECK(service);
+    if (!service)
+        return;
+    auto slow = verify_client::connect(options.name);
+    auto other = verify_client::connect(options.name);
+    CHECK(slow && other);
+    if (!slow || !other)
+        return;
+
+    unsigned accepted = 0;
+    for (uint64_t tag = 0; tag < 10; ++tag)
+        accepted += submit(*slow, tag, 0);
+    CHECK(accepted == options.response_capacity);
+
+    CHECK(submit(*other, 100, 0));
+    const std::vector<verify_response> responses = receive(*other, 1, 60000);
+    CHECK(responses.size() == 1 && responses[0].tag == 100);
+
+    // Polling gives the credits back.
+    CHECK(receive(*slow, 4, 10000).size() == 4);
+    CHECK(submit(*slow, 10, 0));
+    CHECK(receive(*slow, 1, 10000).size() == 1);
+    CHECK(service->num_dropped() == 0);
+}
+
+// A running service keeps its name even with every client slot taken.
+static void test_takeover()
+{
+    verify_service_options options;
+    options.name = segment_name("takeover");
+    options.max_clients = 1;
+    options.num_threads = 1;
+    options.first_epoch = 0;
+    options.last_epoch = 0;
+    auto first = verify_service::create(options);
+    CHECK(first);
+    auto client = verify_client::connect(options.name);
+    CHECK(client);
+
+    auto second = verify_service::create(options);
+    CHECK(!second && errno == EEXIST);
+    client.reset();
+    first.reset();
+    CHECK(!verify_client::connect(options.name));  // Unlinked.
+
+    // A stale segment, left by a crashed service, is taken over.
+    const int fd = shm_open(options.name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    CHECK(fd >= 0 && ftruncate(fd, 4096) == 0);
+    close(fd);
+    auto next = verify_service::create(options);
+    CHECK(next);
+    if (!next)
+        return;
+
+    // A service whose name was taken over leaves the new owner's segment alone.
+    shm_unlink(options.name.c_str());
+    auto newer = verify_service::create(options);
+    CHECK(newer);
+    next.reset();
+    CHECK(verify_client::connect(options.name));
+}
+
+// A client killed at any point, with requests in flight or in the middle
+// of a push or a pop, must not wedge the service nor keep its slot.
+static void test_dead_client()
+{
+    verify_service_options options;
+    options.name = segment_name("dead");
+    options.max_clients = 2;
+    options.num_threads = 2;
+    options.first_epoch = 0;
+    options.last_epoch = 0;
+    auto service = verify_service::create(options);
+    CHECK(service);
+    if (!service)
+        return;
+    auto other = verify_client::connect(options.name);
+    CHECK(other);
+    if (!other)
+        return;
+
+    // Dies holding the only other slot, requests queued and never polled.
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        auto client = verify_client::connect(options.name);
+        for (uint64_t tag = 0; client && tag < 3; ++tag)
+            submit(*client, tag, 0);
+        kill(getpid(), SIGKILL);
+    }
+    CHECK(pid > 0 && waitpid(pid, nullptr, 0) == pid);
+
+    // Killed at random points of a submit/poll loop.
+    std::vector<verify_response> out;
+    for (unsigned i = 0; i < 20; ++i)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            auto client = connect_retry(options.name, 2000);
+            for (uint64_t tag = 0; client; ++tag)
+            {
+                submit(*client, tag, 0);
+                client->poll(out, 16);
+                out.clear();
+            }
+            _exit(1);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200 + 997 * i % 5000));
+        kill(pid, SIGKILL);
+        CHECK(waitpid(pid, nullptr, 0) == pid);
+    }
+
+    auto client = connect_retry(options.name, 2000);
+    CHECK(client);
+    CHECK(service->num_reclaimed() >= 1);
+    if (client)
+    {
+        for (uint64_t tag = 0; tag < 8; ++tag)
+            CHECK(submit(*client, tag, 0));
+        CHECK(receive(*client, 8, 10000).size() == 8);
+    }
+    CHECK(submit(*other, 100, 0));
+    CHECK(receive(*other, 1, 10000).size() == 1);
+}
+
+int main()
+{
+    test_ring();
+    test_ring_threads();
+    test_verify();
+    test_slow_client();
+    test_takeover();
+    test_dead_client();
+
+    return check_result("verify_service_test");
+}
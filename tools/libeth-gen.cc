@@ -0,0 +1,302 @@
+// libeth-gen: offline light cache and DAG generation for an epoch range.
+//
+// Usage: libeth-gen [-o DIR] [-t THREADS] [--dag] <first-epoch> [<last-epoch>]
+//        libeth-gen [-t THREADS] --check FILE [-r RATE] [--order ORDER] <epoch>
+//
+// Writes <DIR>/light-<epoch>.bin for every epoch and, with --dag,
+// <DIR>/dag-<epoch>.bin holding the raw 128-byte dataset items. With
+// --check, recomputes a sample of the items of an existing DAG dump instead.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dag_validator.h"
+#include "ethash.h"
+#include "parallel.h"
+
+// Dataset items computed in memory before each write, 64 MiB.
+constexpr static uint32_t dag_chunk_items = 1 << 19;
+
+using clock_type = std::chrono::steady_clock;
+
+static double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+static double mib(uint64_t bytes)
+{
+    return static_cast<double>(bytes) / (1024 * 1024);
+}
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: libeth-gen [-o DIR] [-t THREADS] [--dag] <first-epoch> [<last-epoch>]\n"
+        "       libeth-gen [-t THREADS] --check FILE [-r RATE] [--order ORDER] <epoch>\n"
+        "  -o, --out DIR       output directory (default: .)\n"
+        "  -t, --threads N     worker threads (default: hardware concurrency)\n"
+        "  -d, --dag           also generate the full DAG of every epoch\n"
+        "  -c, --check FILE    validate the DAG dump FILE of <epoch>\n"
+        "  -r, --rate R        fraction of items to check (default: 0.01)\n"
+        "      --order ORDER   random, strided or full (default: random)\n");
+}
+
+static std::string output_path(const std::string& dir, const char* kind, int epoch)
+{
+    return dir + "/" + kind + "-" + std::to_string(epoch) + ".bin";
+}
+
+using context_ptr = std::unique_ptr<epoch_context_full, void (*)(epoch_context_full*)>;
+
+static bool write_light_cache(const std::string& path, const epoch_context_full* ctx, uint64_t& size)
+{
+    if (!ctx)
+        return false;
+
+    size = get_light_cache_size(ctx->light_cache_num_items);
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    const bool ok = fwrite(ctx->light_cache, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+static bool generate_dag(
+    const std::string& path, const epoch_context_full* ctx, unsigned num_threads, uint64_t& size)
+{
+    if (!ctx)
+        return false;
+
+    const uint32_t num_items = static_cast<uint32_t>(ctx->full_dataset_num_items);
+    size = get_full_dataset_size(ctx->full_dataset_num_items);
+    std::vector<hash1024> chunk(std::min(num_items, dag_chunk_items));
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+
+    bool ok = true;
+    for (uint32_t first = 0; ok && first < num_items; first += dag_chunk_items)
+    {
+        const uint32_t count = std::min(dag_chunk_items, num_items - first);
+        parallel_for(priority_background, 0, count, num_threads, 1024, [&](uint64_t i) {
+            chunk[i] = calculate_dataset_item_1024(*ctx, first + static_cast<uint32_t>(i));
+        });
+        ok = fwrite(chunk.data(), sizeof(hash1024), count, f) == count;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+static int check_dag(const std::string& path, int epoch, const dag_validation_options& options)
+{
+    context_ptr ctx{create_epoch_context(epoch, false), destroy_epoch_context};
+    if (!ctx)
+    {
+        fprintf(stderr, "epoch %d: out of memory\n", epoch);
+        return 1;
+    }
+
+    dag_validation_report report;
+    if (!validate_dag_file(*ctx, path, options, report))
+    {
+        fprintf(stderr, "cannot map %s: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+
+    if (!report.size_ok)
+        printf("%s: size differs from the epoch %d DAG (%llu bytes)\n", path.c_str(), epoch,
+            static_cast<unsigned long long>(get_full_dataset_size(ctx->full_dataset_num_items)));
+    for (const dag_item_range& r : report.mismatches)
+        printf("mismatch: items %u-%u\n", r.first, r.last);
+    printf("epoch %d: %llu items checked, %llu mismatched in %.2f s (%.0f items/s)\n", epoch,
+        static_cast<unsigned long long>(report.items_checked),
+        static_cast<unsigned long long>(report.items_mismatched), report.seconds,
+        report.items_checked / report.seconds);
+    return report.size_ok && report.items_mismatched == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string out_dir = ".";
+    unsigned num_threads = default_num_threads();
+    bool dag = false;
+    std::string check_path;
+    dag_validation_options check_options;
+    std::vector<int> epochs;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if ((!strcmp(arg, "-o") || !strcmp(arg, "--out")) && i + 1 < argc)
+            out_dir = argv[++i];
+        else if ((!strcmp(arg, "-t") || !strcmp(arg, "--threads")) && i + 1 < argc)
+            num_threads = static_cast<unsigned>(std::max(1, atoi(argv[++i])));
+        else if (!strcmp(arg, "-d") || !strcmp(arg, "--dag"))
+            dag = true;
+        else if ((!strcmp(arg, "-c") || !strcmp(arg, "--check")) && i + 1 < argc)
+            check_path = argv[++i];
+        else if ((!strcmp(arg, "-r") || !strcmp(arg, "--rate")) && i + 1 < argc)
+            check_options.sample_rate = atof(argv[++i]);
+        else if (!strcmp(arg, "--order") && i + 1 < argc)
+        {
+            const char* order = argv[++i];
+            if (!strcmp(order, "random"))
+                check_options.order = dag_sample_random;
+            else if (!strcmp(order, "strided"))
+                check_options.order = dag_sample_strided;
+            else if (!strcmp(order, "full"))
+                check_options.order = dag_sample_full;
+            else
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (arg[0] != '-' && epochs.size() < 2)
+            epochs.push_back(atoi(arg));
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+    if (epochs.empty() || epochs[0] < 0)
+    {
+        usage();
+        return 2;
+    }
+    const int first_epoch = epochs[0];
+    const int last_epoch = epochs.size() > 1 ? epochs[1] : first_epoch;
+    if (last_epoch < first_epoch)
+    {
+        usage();
+        return 2;
+    }
+    const int num_epochs = last_epoch - first_epoch + 1;
+
+    thread_pool_options pool_options;
+    pool_options.num_threads = num_threads;
+    configure_shared_thread_pool(pool_options);
+
+    if (!check_path.empty())
+    {
+        if (num_epochs != 1)
+        {
+            usage();
+            return 2;
+        }
+        check_options.num_threads = num_threads;
+        check_options.seed = static_cast<uint64_t>(
+            std::chrono::steady_clock::now().time_since_epoch().count());
+        return check_dag(check_path, first_epoch, check_options);
+    }
+
+    std::mutex print_mutex;
+    std::atomic<bool> failed{false};
+    std::atomic<uint64_t> light_bytes{0};
+
+    // Builds and writes the light cache of epoch, returns its context for the
+    // DAG or nullptr on failure.
+    auto light_cache = [&](int epoch) {
+        const std::string path = output_path(out_dir, "light", epoch);
+        const auto start = clock_type::now();
+        uint64_t size = 0;
+        context_ptr ctx{create_epoch_context(epoch, false), destroy_epoch_context};
+        const bool ok = write_light_cache(path, ctx.get(), size);
+        const double elapsed = seconds_since(start);
+
+        std::lock_guard<std::mutex> lock{print_mutex};
+        if (!ok)
+        {
+            fprintf(stderr, "epoch %d: failed to write %s\n", epoch, path.c_str());
+            failed = true;
+            ctx.reset();
+            return ctx;
+        }
+        light_bytes += size;
+        printf("epoch %d: light cache %.1f MiB in %.2f s (%.1f MiB/s) -> %s\n", epoch,
+            mib(size), elapsed, mib(size) / elapsed, path.c_str());
+        fflush(stdout);
+        return ctx;
+    };
+
+    const auto light_start = clock_type::now();
+    double light_elapsed = 0;
+    if (!dag)
+    {
+        // Light caches are built serially per epoch, so spread epochs over threads.
+        parallel_for(priority_current_epoch, 0, num_epochs, num_threads, 1, [&](uint64_t i) {
+            light_cache(first_epoch + static_cast<int>(i));
+        });
+        light_elapsed = seconds_since(light_start);
+    }
+    else
+    {
+        // A DAG is gigabytes, generate one at a time with all threads on its
+        // items, right after its light cache: only one context is alive at a
+        // time however long the range, and none is built twice.
+        uint64_t dag_bytes = 0;
+        double dag_elapsed = 0;
+        for (int epoch = first_epoch; epoch <= last_epoch; ++epoch)
+        {
+            const auto light_epoch_start = clock_type::now();
+            context_ptr ctx = light_cache(epoch);
+            light_elapsed += seconds_since(light_epoch_start);
+            if (!ctx)
+                continue;
+
+            const std::string path = output_path(out_dir, "dag", epoch);
+            const auto start = clock_type::now();
+            uint64_t size = 0;
+            const bool ok = generate_dag(path, ctx.get(), num_threads, size);
+            ctx.reset();
+            const double elapsed = seconds_since(start);
+            dag_elapsed += elapsed;
+            if (!ok)
+            {
+                fprintf(stderr, "epoch %d: failed to write %s\n", epoch, path.c_str());
+                failed = true;
+                continue;
+            }
+            dag_bytes += size;
+            printf("epoch %d: DAG %.1f MiB in %.2f s (%.1f MiB/s) -> %s\n", epoch, mib(size),
+                elapsed, mib(size) / elapsed, path.c_str());
+            fflush(stdout);
+        }
+        printf("DAGs: %d epochs, %.1f MiB in %.2f s (%.1f MiB/s)\n", num_epochs, mib(dag_bytes),
+            dag_elapsed, mib(dag_bytes) / dag_elapsed);
+    }
+    printf("light caches: %d epochs, %.1f MiB in %.2f s (%.1f MiB/s, %.2f epochs/s)\n",
+        num_epochs, mib(light_bytes), light_elapsed, mib(light_bytes) / light_elapsed,
+        num_epochs / light_elapsed);
+
+    return failed ? 1 : 0;
+}
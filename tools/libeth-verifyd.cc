@@ -0,0 +1,154 @@
+// libeth-verifyd: local share verification service.
+//
+// Usage: libeth-verifyd [-n NAME] [-t THREADS] [-c CLIENTS] [-q CAPACITY]
+//                       [-e FIRST-LAST] [<epoch>...]
+//
+// Owns the epoch contexts for every process on the machine; clients (the
+// addon's VerifyClient) submit requests through the shared memory segment
+// NAME. Only epochs FIRST to LAST are verified, by default the span of the
+// listed epochs; those are built before the service starts accepting work.
+// SIGUSR1 moves the window one epoch forward, e.g. at an epoch switch.
+
+/**
+ * Copyright 2021 Karthick S. (yuvikarti#gmail.com)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ethash.h"
+#include "parallel.h"
+#include "verify_service.h"
+
+static void usage()
+{
+    fprintf(stderr,
+        "usage: libeth-verifyd [-n NAME] [-t THREADS] [-c CLIENTS] [-q CAPACITY]\n"
+        "                      [-e FIRST-LAST] [<epoch>...]\n"
+        "  -n, --name NAME       shared memory name (default: /libeth-verify)\n"
+        "  -t, --threads N       verification threads (default: hardware concurrency)\n"
+        "  -c, --clients N       client slots (default: 64)\n"
+        "  -q, --queue N         request queue of each client, power of two (default: 1024)\n"
+        "  -e, --epochs A-B      epochs to verify (default: the listed epochs)\n");
+}
+
+int main(int argc, char* argv[])
+{
+    verify_service_options options;
+    std::vector<int> preload;
+    bool window = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        if ((!strcmp(arg, "-n") || !strcmp(arg, "--name")) && i + 1 < argc)
+            options.name = argv[++i];
+        else if ((!strcmp(arg, "-t") || !strcmp(arg, "--threads")) && i + 1 < argc)
+            options.num_threads = static_cast<unsigned>(atoi(argv[++i]));
+        else if ((!strcmp(arg, "-c") || !strcmp(arg, "--clients")) && i + 1 < argc)
+            options.max_clients = static_cast<uint32_t>(atoi(argv[++i]));
+        else if ((!strcmp(arg, "-q") || !strcmp(arg, "--queue")) && i + 1 < argc)
+            options.request_capacity = static_cast<uint32_t>(atoi(argv[++i]));
+        else if ((!strcmp(arg, "-e") || !strcmp(arg, "--epochs")) && i + 1 < argc)
+        {
+            window = sscanf(argv[++i], "%d-%d", &options.first_epoch, &options.last_epoch) == 2;
+            if (!window)
+            {
+                usage();
+                return 2;
+            }
+        }
+        else if (arg[0] != '-')
+            preload.push_back(atoi(arg));
+        else
+        {
+            usage();
+            return 2;
+        }
+    }
+
+    if (!window && !preload.empty())
+    {
+        options.first_epoch = *std::min_element(preload.begin(), preload.end());
+        options.last_epoch = *std::max_element(preload.begin(), preload.end());
+    }
+    else if (!window)
+    {
+        fprintf(stderr, "libeth-verifyd: give the epochs to verify (-e or a list)\n");
+        usage();
+        return 2;
+    }
+    for (int epoch : preload)
+    {
+        if (epoch < options.first_epoch || epoch > options.last_epoch)
+        {
+            fprintf(stderr, "libeth-verifyd: epoch %d is outside %d-%d\n", epoch,
+                options.first_epoch, options.last_epoch);
+            return 2;
+        }
+    }
+
+    // Handle signals synchronously so the destructor can unlink the segment.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    parallel_for(priority_current_epoch, 0, preload.size(), 0, 1, [&](uint64_t i) {
+        if (!shared_epoch_contexts().get(preload[i]))
+            fprintf(stderr, "epoch %d: out of memory\n", preload[i]);
+    });
+
+    auto service = verify_service::create(options);
+    if (!service)
+    {
+        fprintf(stderr, "libeth-verifyd: cannot create %s: %s\n", options.name.c_str(),
+            strerror(errno));
+        return 1;
+    }
+    printf("libeth-verifyd: serving %s, epochs %d-%d\n", options.name.c_str(),
+        options.first_epoch, options.last_epoch);
+    fflush(stdout);
+
+    int sig = 0;
+    while (sigwait(&signals, &sig) == 0 && sig == SIGUSR1)
+    {
+        if (options.last_epoch == max_epoch_number)
+            continue;
+        ++options.first_epoch;
+        ++options.last_epoch;
+        service->set_epoch_window(options.first_epoch, options.last_epoch);
+        printf("libeth-verifyd: epochs %d-%d\n", options.first_epoch, options.last_epoch);
+        fflush(stdout);
+        if (!shared_epoch_contexts().get(options.last_epoch))
+            fprintf(stderr, "epoch %d: out of memory\n", options.last_epoch);
+    }
+
+    const uint64_t num_verified = service->num_verified();
+    service.reset();
+    printf("libeth-verifyd: %s, %llu requests verified\n", strsignal(sig),
+        static_cast<unsigned long long>(num_verified));
+    return 0;
+}